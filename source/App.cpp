@@ -3,12 +3,32 @@
 #include "RayTraceGeometry.h"
 #include "Camera.h"
 #include "SoftRayTracingRenderer.h"
-#include "Material.h"
+#include "SceneArena.h"
+#include "DefaultScene.h"
+#include "OfflineRender.h"
+#include "RenderServer.h"
+#include "EnvironmentLight.h"
+#include <chrono>
 
 // Tells C++ to invoke command-line main() function even on OS X and Win32.
 G3D_START_AT_MAIN();
 
 int main(int argc, const char* argv[]) {
+    SoftRayTracing::OfflineRenderSettings offlineSettings;
+    if (SoftRayTracing::OfflineRenderSettings::parse(argc, argv, offlineSettings)) {
+        // Headless: no window or OpenGL context
+        initG3D();
+        return SoftRayTracing::runOfflineRender(offlineSettings);
+    }
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--server") == 0) {
+            // Keep the scene resident and take jobs on stdin until told to quit
+            initG3D();
+            SoftRayTracing::RenderServer::create()->serve();
+            return 0;
+        }
+    }
+
     initGLG3D(G3DSpecification());
 
     GApp::Settings settings(argc, argv);
@@ -63,10 +83,11 @@ int main(int argc, const char* argv[]) {
 }
 
 
-App::App(const GApp::Settings& settings) : GApp(settings) {
+App::App(const GApp::Settings& settings) : GApp(settings), m_startTime(0), m_timeToFirstPixel(-1), m_timeToFullSpeed(-1) {
 }
 
 void App::onInit() {
+    m_startTime = System::time();
     GApp::onInit();
 
     setFrameDuration(1.0f / 240.0f);
@@ -74,12 +95,19 @@ void App::onInit() {
     showRenderingStats      = true;
 
     m_softRayTracingRenderer = SoftRayTracing::SoftRayTracingRenderer::create(4, 16);
-    m_camera = SoftRayTracing::PerspectiveCamera::create(Vector3(2.0f, 0, 1.5f), Quat::fromAxisAngleRotation(Vector3(0.0f, 1.0f, 0.0f), toRadians(30.0f)));
-
-    m_sceneObjects.append(SoftRayTracing::Sphere::create(Vector3(0, 0, -3), 1.0f));
-    m_sceneObjects.append(SoftRayTracing::Plane::create(Vector3(0, -1.0f, -3), Quat::fromAxisAngleRotation(Vector3(0, 1, 0), toRadians(0.0f)), Vector2::one() * 4.0f));
-    m_sceneObjects.append(SoftRayTracing::Sphere::create(Vector3(-2, 0, -3), 1.0f, SoftRayTracing::s_orangeMetal));
-    m_sceneObjects.append(SoftRayTracing::Sphere::create(Vector3(2, 0, -3), 1.0f, SoftRayTracing::s_transparentGlass));
+    m_softRayTracingRenderer->setFrameTimeBudget(1.0 / 30.0);
+    m_softRayTracingRenderer->setAsyncAccelerationBuild(true);
+    m_camera = SoftRayTracing::createDefaultCamera();
+
+    // Frames start with an empty scene under the constant sky, and pick the objects and the environment up in
+    // onGraphics3D as each load finishes
+    m_sceneArena = SoftRayTracing::SceneArena::create();
+    m_objectsLoad = std::async(std::launch::async, [this] {
+        SoftRayTracing::buildDefaultScene(*m_sceneArena, m_loadedObjects);
+    });
+    m_environmentLoad = std::async(std::launch::async, [] {
+        return SoftRayTracing::loadDefaultEnvironment();
+    });
 
     makeGUI();
 }
@@ -93,7 +121,60 @@ void App::onGraphics3D(RenderDevice* rd, Array<shared_ptr<Surface> >& allSurface
 {
     GApp::onGraphics3D(rd, allSurfaces);
 
+    if (m_objectsLoad.valid() && m_objectsLoad.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        m_objectsLoad.get();
+        m_sceneObjects = m_loadedObjects;
+        logPrintf("Objects loaded after %.3f s. Arena: %d objects, %.1f bytes/object, %d bytes reserved\n", System::time() - m_startTime,
+            m_sceneArena->objectCount(), m_sceneArena->bytesPerObject(), int(m_sceneArena->bytesReserved()));
+    }
+    if (m_environmentLoad.valid() && m_environmentLoad.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        m_softRayTracingRenderer->setEnvironment(m_environmentLoad.get());
+        logPrintf("Environment loaded after %.3f s\n", System::time() - m_startTime);
+    }
+
+    m_softRayTracingRenderer->setFocusPoint(userInput->mouseXY());
 	m_softRayTracingRenderer->render(rd, m_camera, m_sceneObjects);
+
+    // Frames before the objects arrive only show the sky
+    if (m_timeToFirstPixel < 0 && m_sceneObjects.size() > 0) {
+        m_timeToFirstPixel = System::time() - m_startTime;
+        logPrintf("Time to first pixel: %.3f s\n", m_timeToFirstPixel);
+    }
+    if (m_timeToFullSpeed < 0 && !m_objectsLoad.valid() && m_softRayTracingRenderer->accelerationReady()) {
+        m_timeToFullSpeed = System::time() - m_startTime;
+        logPrintf("Time to full speed: %.3f s\n", m_timeToFullSpeed);
+    }
+    screenPrintf("%.3f s to first pixel, %.3f s to full speed", m_timeToFirstPixel, m_timeToFullSpeed);
+    screenPrintf("%.2f Mrays/s (%s)", m_softRayTracingRenderer->raysPerSecond() / 1e6,
+        m_softRayTracingRenderer->usePackedScene() ? "packed" : "virtual");
+    screenPrintf("%.1f MB peak resident, %.1f MB uploaded per frame", m_softRayTracingRenderer->peakResidentBytes() / 1e6,
+        m_softRayTracingRenderer->uploadBytesPerFrame() / 1e6);
+}
+
+
+void App::onUserInput(UserInput* ui) {
+    GApp::onUserInput(ui);
+
+    typedef SoftRayTracing::SoftRayTracingRenderer::DisplayMode DisplayMode;
+    if (ui->keyPressed(GKey('h'))) {
+        switch (m_softRayTracingRenderer->displayMode()) {
+        case DisplayMode::Color:             m_softRayTracingRenderer->setDisplayMode(DisplayMode::IntersectionTests); break;
+        case DisplayMode::IntersectionTests: m_softRayTracingRenderer->setDisplayMode(DisplayMode::Bounces); break;
+        default:                             m_softRayTracingRenderer->setDisplayMode(DisplayMode::Color); break;
+        }
+    }
+
+    if (ui->keyPressed(GKey('p'))) {
+        m_softRayTracingRenderer->setUsePackedScene(!m_softRayTracingRenderer->usePackedScene());
+    }
+
+    if (ui->keyPressed(GKey('t'))) {
+        if (m_softRayTracingRenderer->tracing()) {
+            m_softRayTracingRenderer->stopTrace("trace.json");
+        } else {
+            m_softRayTracingRenderer->startTrace();
+        }
+    }
 }
 
 
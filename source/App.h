@@ -6,12 +6,15 @@
  */
 #pragma once
 #include <G3D/G3D.h>
+#include <future>
 
 namespace SoftRayTracing
 {
 	class Hittable;
 	class Camera;
 	class SoftRayTracingRenderer;
+	class SceneArena;
+	class EnvironmentLight;
 }
 
 /** \brief Application framework. */
@@ -29,11 +32,35 @@ public:
 
     virtual void onGraphics3D(RenderDevice* rd, Array<shared_ptr<Surface> >& surface3D) override;
     virtual void onGraphics2D(RenderDevice* rd, Array<shared_ptr<Surface2D> >& surface2D) override;
+
+    /** H cycles the traversal cost heatmaps, P toggles the packed scene against the virtual API,
+        T starts and stops a Chrome trace written to trace.json */
+    virtual void onUserInput(UserInput* ui) override;
 		
 private:
+    // m_sceneObjects and m_loadedObjects point into this arena; as the first member it is destroyed after them
+    ReferenceCountedPointer<SoftRayTracing::SceneArena> m_sceneArena;
+
     ReferenceCountedPointer<SoftRayTracing::SoftRayTracingRenderer> m_softRayTracingRenderer;
 
     ReferenceCountedPointer<SoftRayTracing::Camera> m_camera;
 
     Array<ReferenceCountedPointer<SoftRayTracing::Hittable>> m_sceneObjects;
+
+    // Filled by the objects load on a background thread, and only touched here once m_objectsLoad is ready
+    Array<ReferenceCountedPointer<SoftRayTracing::Hittable>> m_loadedObjects;
+
+    RealTime m_startTime;
+
+    // Seconds from onInit to the first presented frame that traced the scene's objects, and to the first frame
+    // of the whole scene traced through the packed scene; negative until reached
+    RealTime m_timeToFirstPixel;
+
+    RealTime m_timeToFullSpeed;
+
+    // Declared last so they are destroyed first: m_objectsLoad waits for a load that still uses the members above.
+    // The objects and the environment load separately, so the objects show up without waiting for the environment.
+    std::future<void> m_objectsLoad;
+
+    std::future<ReferenceCountedPointer<SoftRayTracing::EnvironmentLight>> m_environmentLoad;
 };
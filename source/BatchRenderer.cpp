@@ -0,0 +1,68 @@
+#include "BatchRenderer.h"
+#include "SoftRayTracingRenderer.h"
+#include "TileScheduler.h"
+
+namespace SoftRayTracing
+{
+	ReferenceCountedPointer<BatchRenderer> BatchRenderer::create(const Array<ReferenceCountedPointer<Hittable>>& objects,
+		const ReferenceCountedPointer<PackedScene>& packedScene, const ReferenceCountedPointer<EnvironmentLight>& environment,
+		int raysPerPixel, int maxBounceTime)
+	{
+		return createShared<BatchRenderer>(objects, packedScene, environment, raysPerPixel, maxBounceTime);
+	}
+
+	BatchRenderer::BatchRenderer(const Array<ReferenceCountedPointer<Hittable>>& objects, const ReferenceCountedPointer<PackedScene>& packedScene,
+		const ReferenceCountedPointer<EnvironmentLight>& environment, int raysPerPixel, int maxBounceTime)
+		: m_objects(objects), m_packedScene(packedScene), m_environment(environment), m_raysPerPixel(raysPerPixel), m_maxBounceTime(maxBounceTime), m_raysPerSecond(0.0)
+	{
+	}
+
+	void BatchRenderer::renderPass(const Array<ReferenceCountedPointer<Camera>>& cameras, int width, int height)
+	{
+		const RealTime startTime = System::time();
+		while (m_views.size() < cameras.size())
+		{
+			ReferenceCountedPointer<SoftRayTracingRenderer> view = SoftRayTracingRenderer::create(m_raysPerPixel, m_maxBounceTime);
+			view->setScene(m_objects, m_packedScene);
+			view->setEnvironment(m_environment);
+			view->setCoarsePasses(0);
+			m_views.append(view);
+		}
+		m_views.resize(cameras.size());
+
+		int maxTiles = 0;
+		m_tileCounts.resize(m_views.size());
+		for (int v = 0; v < m_views.size(); v++)
+		{
+			m_tileCounts[v] = m_views[v]->beginBatchPass(cameras[v], m_objects, width, height);
+			maxTiles = max(maxTiles, m_tileCounts[v]);
+		}
+
+		// Round robin over the views' spiral orders: every view's centre tiles come first
+		m_schedule.fastClear();
+		for (int t = 0; t < maxTiles; t++)
+		{
+			for (int v = 0; v < m_views.size(); v++)
+			{
+				if (t < m_tileCounts[v])
+				{
+					TileRef& ref = m_schedule.next();
+					ref.view = v;
+					ref.tile = t;
+				}
+			}
+		}
+
+		TileScheduler::run(m_schedule.size(), [this](int i)
+		{
+			m_views[m_schedule[i].view]->renderBatchTile(m_schedule[i].tile);
+		});
+
+		int64 rayCount = 0;
+		for (const ReferenceCountedPointer<SoftRayTracingRenderer>& view : m_views)
+		{
+			rayCount += view->endBatchPass();
+		}
+		m_raysPerSecond = rayCount / max(System::time() - startTime, 1e-6);
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include<G3D/G3D.h>
+
+namespace SoftRayTracing
+{
+	class Hittable;
+
+	class Camera;
+
+	class PackedScene;
+
+	class EnvironmentLight;
+
+	class SoftRayTracingRenderer;
+
+	/// <summary>
+	/// renders one static scene from many cameras (turntables, stereo pairs, probe grids). Every view has its own
+	/// accumulation but shares the packed scene, and each pass of all views is a single TileScheduler job with
+	/// the views' tiles interleaved, so no core idles at the end of one view while another still has work.
+	/// </summary>
+	class BatchRenderer : public ReferenceCountedObject
+	{
+	public:
+		/// <summary>
+		/// add one pass to every view. Each camera must be a distinct object; a camera that moved since the last
+		/// call is reprojected like in the interactive renderer.
+		/// </summary>
+		void renderPass(const Array<ReferenceCountedPointer<Camera>>& cameras, int width, int height);
+
+		inline int viewCount() const { return m_views.size(); }
+
+		/// Per-view output: accumulation, writeImage, relativeError, ...
+		inline const ReferenceCountedPointer<SoftRayTracingRenderer>& view(int index) const { return m_views[index]; }
+
+		/// Rays traced per second by the last renderPass, over all views
+		inline double raysPerSecond() const { return m_raysPerSecond; }
+
+	public:
+		static ReferenceCountedPointer<BatchRenderer> create(const Array<ReferenceCountedPointer<Hittable>>& objects,
+			const ReferenceCountedPointer<PackedScene>& packedScene, const ReferenceCountedPointer<EnvironmentLight>& environment,
+			int raysPerPixel, int maxBounceTime);
+
+	protected:
+		BatchRenderer(const Array<ReferenceCountedPointer<Hittable>>& objects, const ReferenceCountedPointer<PackedScene>& packedScene,
+			const ReferenceCountedPointer<EnvironmentLight>& environment, int raysPerPixel, int maxBounceTime);
+
+		struct TileRef
+		{
+			int view;
+			int tile;
+		};
+
+		Array<ReferenceCountedPointer<Hittable>> m_objects;
+
+		ReferenceCountedPointer<PackedScene> m_packedScene;
+
+		ReferenceCountedPointer<EnvironmentLight> m_environment;
+
+		int m_raysPerPixel;
+
+		int m_maxBounceTime;
+
+		Array<ReferenceCountedPointer<SoftRayTracingRenderer>> m_views;
+
+		// Tiles in the current pass of each view
+		Array<int> m_tileCounts;
+
+		Array<TileRef> m_schedule;
+
+		double m_raysPerSecond;
+	};
+}
@@ -4,44 +4,46 @@ namespace SoftRayTracing
 {
 	void SoftRayTracing::Camera::RecalculateViewMatrix()
 	{
-		viewMatrix = Matrix4::translation(-position) * Matrix4(rotation.toRotationMatrix());
+		viewMatrix = Matrix4(rotation.toRotationMatrix()).transpose() * Matrix4::translation(-position);
 	}
 
-	void PerspectiveCamera::generateRays(Array<Ray>& raysBuffer, uint32_t width, int rayPerPixel)
+	Ray PerspectiveCamera::generateRay(float x, float y, uint32_t width) const
 	{
 		Matrix3 rotationMatrix = rotation.toRotationMatrix();
 		Vector3 forward = -rotationMatrix.column(2);
 		Vector3 right = rotationMatrix.column(0);
 		Vector3 up = rotationMatrix.column(1);
 
-		int height = width / aspectRatio;
+		float height = width / aspectRatio;
 
 		float rfovx = toRadians(fovx);
 		Vector2 size = Vector2(tan(rfovx/2)*nearPlane, tan(rfovx/2)*nearPlane/aspectRatio);
-		Vector2 deltaSize = Vector2(2.0f / width, 2.0f / height);
-		for(int j = 0; j < height; j++)
+		float u = 2.0f * (x / width) - 1.0f;
+		float v = 2.0f * ((height - y) / height) - 1.0f;
+		Vector3 direction = forward * nearPlane + right * size.x * u + up * size.y * v;
+		return Ray::fromOriginAndDirection(position, direction.direction());
+	}
+
+	bool PerspectiveCamera::projectToPixel(const Matrix4& view, const Vector4& worldPoint, uint32_t width, Vector2& pixel) const
+	{
+		Vector4 cameraSpace = view * worldPoint;
+		if (cameraSpace.z >= 0.0f)
 		{
-			float v = 2.0f * ((height - j + 0.5f) / height) - 1.0f;
-			for (int i = 0; i < width; i++)
-			{
-				float u = 2.0f * ((i + 0.5f) / width) - 1.0f;
-				if (rayPerPixel > 1)
-				{
-					for (int k = 0; k < rayPerPixel; k++)
-					{
-						float deltau = uniformRandom(-0.5f, 0.5f) * deltaSize.x;
-						float deltav = uniformRandom(-0.5f, 0.5f) * deltaSize.y;
-						Vector3 direction = forward * nearPlane + right * size.x * (u + deltau) + up * size.y * (v + deltav);
-						raysBuffer.append(Ray::fromOriginAndDirection(position, direction.direction()));
-					}
-				}
-				else
-				{
-					Vector3 direction = forward * nearPlane + right * size.x * u + up * size.y * v;
-					raysBuffer.append(Ray::fromOriginAndDirection(position, direction.direction()));
-				}
-			}
+			return false;
 		}
+
+		float height = width / aspectRatio;
+
+		float rfovx = toRadians(fovx);
+		Vector2 size = Vector2(tan(rfovx/2)*nearPlane, tan(rfovx/2)*nearPlane/aspectRatio);
+		float scale = nearPlane / -cameraSpace.z;
+		float u = cameraSpace.x * scale / size.x;
+		float v = cameraSpace.y * scale / size.y;
+
+		// Inverse of the pixel to (u, v) mapping used by generateRay
+		pixel.x = 0.5f * (u + 1.0f) * width;
+		pixel.y = height - 0.5f * (v + 1.0f) * height;
+		return pixel.x >= 0.0f && pixel.x < width && pixel.y >= 0.0f && pixel.y < height;
 	}
 
 	ReferenceCountedPointer<PerspectiveCamera> SoftRayTracing::PerspectiveCamera::create(Vector3 position, Quat rotation, float aspectRatio, float nearPlane, float farPlane)
@@ -57,6 +59,7 @@ namespace SoftRayTracing
 		this->farPlane = farPlane;
 		this->rotation = rotation;
 		fovx = 90.0f;
+		RecalculateViewMatrix();
 	}
 }
 
@@ -6,7 +6,17 @@ namespace SoftRayTracing
 	class Camera : public ReferenceCountedObject
 	{
 	public:
-		virtual void generateRays(Array<Ray>& raysBuffer, uint32_t width, int rayPerPixel = 1) = 0;
+		/// <summary>
+		/// generate the ray through continuous pixel coordinates (x, y); pixel (i, j) covers [i, i + 1) x [j, j + 1)
+		/// </summary>
+		virtual Ray generateRay(float x, float y, uint32_t width) const = 0;
+
+		/// <summary>
+		/// project a world space point (w = 1) or direction (w = 0) to continuous pixel coordinates
+		/// as seen through the given view matrix, using this camera's projection
+		/// </summary>
+		/// <returns>false if the point is behind the camera or outside the frame</returns>
+		virtual bool projectToPixel(const Matrix4& view, const Vector4& worldPoint, uint32_t width, Vector2& pixel) const = 0;
 
 	public:
 
@@ -61,7 +71,9 @@ namespace SoftRayTracing
 	class PerspectiveCamera : public Camera
 	{
 	public:
-		virtual void generateRays(Array<Ray>& raysBuffer, uint32_t width, int rayPerPixel) override;
+		virtual Ray generateRay(float x, float y, uint32_t width) const override;
+
+		virtual bool projectToPixel(const Matrix4& view, const Vector4& worldPoint, uint32_t width, Vector2& pixel) const override;
 
 		static ReferenceCountedPointer<PerspectiveCamera> create(Vector3 position = Vector3::zero(), Quat rotation = Quat::fromAxisAngleRotation(Vector3(0,1,0), 0.0f)
 			, float aspectRatio = 16.0f/9.0f, float nearPlane = 1.0f, float farPlane = 1000.0f);
@@ -0,0 +1,180 @@
+#include "Checkpoint.h"
+#include <cstdio>
+#ifdef G3D_WINDOWS
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace SoftRayTracing
+{
+	static const uint32 s_checkpointMagic = 0x43545253; // "SRTC"
+
+	static const uint32 s_checkpointVersion = 3;
+
+	static bool replaceFile(const String& from, const String& to)
+	{
+#ifdef G3D_WINDOWS
+		return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+		return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+	}
+
+	static bool syncFile(FILE* file)
+	{
+#ifdef G3D_WINDOWS
+		return _commit(_fileno(file)) == 0;
+#else
+		return fsync(fileno(file)) == 0;
+#endif
+	}
+
+	bool CheckpointData::write(const String& filename, const CheckpointData& data)
+	{
+		const String tempFilename = filename + ".tmp";
+		FILE* file = fopen(tempFilename.c_str(), "wb");
+		if (!file)
+		{
+			return false;
+		}
+
+		const uint32 pixelCount = data.accumulation.size();
+		float view[16];
+		for (int i = 0; i < 16; i++)
+		{
+			view[i] = data.viewMatrix[i / 4][i % 4];
+		}
+
+		bool ok =
+			fwrite(&s_checkpointMagic, sizeof(uint32), 1, file) == 1 &&
+			fwrite(&s_checkpointVersion, sizeof(uint32), 1, file) == 1 &&
+			fwrite(&data.width, sizeof(uint32), 1, file) == 1 &&
+			fwrite(&data.height, sizeof(uint32), 1, file) == 1 &&
+			fwrite(&data.sampleSeed, sizeof(uint64), 1, file) == 1 &&
+			fwrite(&data.passIndex, sizeof(uint64), 1, file) == 1 &&
+			fwrite(&data.raysPerPixel, sizeof(int32), 1, file) == 1 &&
+			fwrite(&data.maxBounces, sizeof(int32), 1, file) == 1 &&
+			fwrite(&data.sceneHash, sizeof(uint64), 1, file) == 1 &&
+			fwrite(view, sizeof(float), 16, file) == 16 &&
+			fwrite(&pixelCount, sizeof(uint32), 1, file) == 1 &&
+			fwrite(data.accumulation.getCArray(), sizeof(Color3), pixelCount, file) == pixelCount &&
+			fwrite(data.luminanceSquaredSum.getCArray(), sizeof(float), pixelCount, file) == pixelCount &&
+			fwrite(data.sampleCount.getCArray(), sizeof(float), pixelCount, file) == pixelCount;
+		ok = (fflush(file) == 0) && ok;
+		ok = ok && syncFile(file);
+		ok = (fclose(file) == 0) && ok;
+
+		if (!ok || !replaceFile(tempFilename, filename))
+		{
+			std::remove(tempFilename.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	bool CheckpointData::read(const String& filename, CheckpointData& data)
+	{
+		FILE* file = fopen(filename.c_str(), "rb");
+		if (!file)
+		{
+			return false;
+		}
+
+		uint32 magic = 0, version = 0, pixelCount = 0;
+		float view[16];
+		bool ok =
+			fread(&magic, sizeof(uint32), 1, file) == 1 && magic == s_checkpointMagic &&
+			fread(&version, sizeof(uint32), 1, file) == 1 && version == s_checkpointVersion &&
+			fread(&data.width, sizeof(uint32), 1, file) == 1 &&
+			fread(&data.height, sizeof(uint32), 1, file) == 1 &&
+			fread(&data.sampleSeed, sizeof(uint64), 1, file) == 1 &&
+			fread(&data.passIndex, sizeof(uint64), 1, file) == 1 &&
+			fread(&data.raysPerPixel, sizeof(int32), 1, file) == 1 &&
+			fread(&data.maxBounces, sizeof(int32), 1, file) == 1 &&
+			fread(&data.sceneHash, sizeof(uint64), 1, file) == 1 &&
+			fread(view, sizeof(float), 16, file) == 16 &&
+			fread(&pixelCount, sizeof(uint32), 1, file) == 1 &&
+			pixelCount == data.width * data.height;
+
+		if (ok)
+		{
+			data.accumulation.resize(pixelCount);
+			data.luminanceSquaredSum.resize(pixelCount);
+			data.sampleCount.resize(pixelCount);
+			ok = fread(data.accumulation.getCArray(), sizeof(Color3), pixelCount, file) == pixelCount &&
+				fread(data.luminanceSquaredSum.getCArray(), sizeof(float), pixelCount, file) == pixelCount &&
+				fread(data.sampleCount.getCArray(), sizeof(float), pixelCount, file) == pixelCount;
+			for (int i = 0; i < 16; i++)
+			{
+				data.viewMatrix[i / 4][i % 4] = view[i];
+			}
+		}
+		fclose(file);
+		return ok;
+	}
+
+	ReferenceCountedPointer<CheckpointWriter> CheckpointWriter::create(const String& filename)
+	{
+		return createShared<CheckpointWriter>(filename);
+	}
+
+	CheckpointWriter::CheckpointWriter(const String& filename)
+		: m_filename(filename), m_writing(false), m_quit(false)
+	{
+		m_thread = std::thread(&CheckpointWriter::threadMain, this);
+	}
+
+	CheckpointWriter::~CheckpointWriter()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_quit = true;
+		}
+		m_condition.notify_all();
+		m_thread.join();
+	}
+
+	void CheckpointWriter::submit(const shared_ptr<CheckpointData>& data)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_pending = data;
+		}
+		m_condition.notify_all();
+	}
+
+	void CheckpointWriter::flush()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_condition.wait(lock, [this] { return !m_pending && !m_writing; });
+	}
+
+	void CheckpointWriter::threadMain()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true)
+		{
+			m_condition.wait(lock, [this] { return m_quit || m_pending; });
+			if (!m_pending)
+			{
+				return;
+			}
+
+			shared_ptr<CheckpointData> data = m_pending;
+			m_pending = nullptr;
+			m_writing = true;
+			lock.unlock();
+
+			if (!CheckpointData::write(m_filename, *data))
+			{
+				logPrintf("Failed to write checkpoint %s\n", m_filename.c_str());
+			}
+
+			lock.lock();
+			m_writing = false;
+			m_condition.notify_all();
+		}
+	}
+}
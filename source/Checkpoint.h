@@ -0,0 +1,75 @@
+#pragma once
+#include<G3D/G3D.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace SoftRayTracing
+{
+	/// <summary>
+	/// everything needed to continue a progressive render: the float accumulation, per-pixel sample counts
+	/// and the position in the sample sequence
+	/// </summary>
+	struct CheckpointData
+	{
+		uint32 width = 0;
+		uint32 height = 0;
+		uint64 sampleSeed = 0;
+		uint64 passIndex = 0;
+		// Settings and scene the accumulation was rendered with; resuming with anything else would mix estimates
+		int32 raysPerPixel = 0;
+		int32 maxBounces = 0;
+		uint64 sceneHash = 0;
+		Matrix4 viewMatrix;
+		Array<Color3> accumulation;
+		Array<float> luminanceSquaredSum;
+		Array<float> sampleCount;
+
+		/// <summary>
+		/// write to a temporary file next to filename, flush it to disk and rename it over filename, so neither
+		/// a crash nor a node going away leaves a torn checkpoint
+		/// </summary>
+		static bool write(const String& filename, const CheckpointData& data);
+
+		static bool read(const String& filename, CheckpointData& data);
+	};
+
+	/// <summary>
+	/// writes checkpoints on a background thread. Only the newest submitted snapshot is kept, so a slow disk
+	/// drops intermediate checkpoints instead of stalling the renderer.
+	/// </summary>
+	class CheckpointWriter : public ReferenceCountedObject
+	{
+	public:
+		void submit(const shared_ptr<CheckpointData>& data);
+
+		/// Block until the pending checkpoint, if any, is on disk
+		void flush();
+
+		inline const String& filename() const { return m_filename; }
+
+	public:
+		static ReferenceCountedPointer<CheckpointWriter> create(const String& filename);
+
+		~CheckpointWriter();
+
+	protected:
+		CheckpointWriter(const String& filename);
+
+		void threadMain();
+
+		String m_filename;
+
+		std::thread m_thread;
+
+		std::mutex m_mutex;
+
+		std::condition_variable m_condition;
+
+		shared_ptr<CheckpointData> m_pending;
+
+		bool m_writing;
+
+		bool m_quit;
+	};
+}
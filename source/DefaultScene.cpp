@@ -0,0 +1,46 @@
+#include "DefaultScene.h"
+#include "RayTraceGeometry.h"
+#include "Camera.h"
+#include "Material.h"
+#include "SceneArena.h"
+#include "EnvironmentLight.h"
+
+namespace SoftRayTracing
+{
+	void buildDefaultScene(SceneArena& arena, Array<ReferenceCountedPointer<Hittable>>& objects)
+	{
+		objects.append(Sphere::create(arena, Vector3(0, 0, -3), 1.0f));
+		objects.append(Plane::create(arena, Vector3(0, -1.0f, -3), Quat::fromAxisAngleRotation(Vector3(0, 1, 0), toRadians(0.0f)), Vector2::one() * 4.0f));
+		objects.append(Sphere::create(arena, Vector3(-2, 0, -3), 1.0f, s_orangeMetal));
+		objects.append(Sphere::create(arena, Vector3(2, 0, -3), 1.0f, s_transparentGlass));
+	}
+
+	ReferenceCountedPointer<Camera> createDefaultCamera()
+	{
+		return PerspectiveCamera::create(Vector3(2.0f, 0, 1.5f), Quat::fromAxisAngleRotation(Vector3(0.0f, 1.0f, 0.0f), toRadians(30.0f)));
+	}
+
+	Array<ReferenceCountedPointer<Camera>> createTurntableCameras(int count)
+	{
+		const Vector3 centre(0, 0, -3);
+		const float radius = 4.5f;
+		Array<ReferenceCountedPointer<Camera>> cameras;
+		for (int i = 0; i < count; i++)
+		{
+			// Cameras look down -Z, so a yaw of angle faces the centre from (sin, 0, cos) * radius
+			const float angle = 2.0f * pif() * i / count;
+			cameras.append(PerspectiveCamera::create(centre + Vector3(sin(angle), 0.0f, cos(angle)) * radius, Quat::fromAxisAngleRotation(Vector3(0.0f, 1.0f, 0.0f), angle)));
+		}
+		return cameras;
+	}
+
+	ReferenceCountedPointer<EnvironmentLight> loadDefaultEnvironment()
+	{
+		const String environmentFilename = "cubemap/noonclouds/noonclouds_*.png";
+		if (!EnvironmentLight::exists(environmentFilename))
+		{
+			return nullptr;
+		}
+		return EnvironmentLight::create(environmentFilename);
+	}
+}
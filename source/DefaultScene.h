@@ -0,0 +1,27 @@
+#pragma once
+#include<G3D/G3D.h>
+
+namespace SoftRayTracing
+{
+	class Hittable;
+
+	class Camera;
+
+	class SceneArena;
+
+	class EnvironmentLight;
+
+	/// <summary>
+	/// the demo scene shared by the interactive app and the headless renderer: three spheres on a plane,
+	/// allocated from arena
+	/// </summary>
+	void buildDefaultScene(SceneArena& arena, Array<ReferenceCountedPointer<Hittable>>& objects);
+
+	ReferenceCountedPointer<Camera> createDefaultCamera();
+
+	/// count cameras evenly spaced on a circle around the scene, all looking at its centre
+	Array<ReferenceCountedPointer<Camera>> createTurntableCameras(int count);
+
+	/// <returns>the default environment map, or nullptr if its files cannot be found</returns>
+	ReferenceCountedPointer<EnvironmentLight> loadDefaultEnvironment();
+}
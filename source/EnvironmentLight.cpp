@@ -0,0 +1,291 @@
+#include "EnvironmentLight.h"
+#include "Utils.h"
+#include <algorithm>
+
+namespace SoftRayTracing
+{
+	// Every file naming convention G3D knows; the one whose six faces exist is used
+	static const CubeMapConvention::Value s_cubeConventions[] =
+		{ CubeMapConvention::QUAKE, CubeMapConvention::UNREAL, CubeMapConvention::G3D, CubeMapConvention::DIRECTX };
+
+	static inline Vector3 equirectDirection(float u, float v)
+	{
+		float phi = 2.0f * pif() * u - pif();
+		float theta = pif() * v;
+		return Vector3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+	}
+
+	static Color3 readTexel(const shared_ptr<Image>& image, int x, int y)
+	{
+		Color3 color;
+		image->get(Point2int32(clamp(x, 0, image->width() - 1), clamp(y, 0, image->height() - 1)), color);
+		// Low dynamic range images are stored gamma encoded
+		return image->format()->floatingPoint ? color : gammaToLinear(color);
+	}
+
+	static String cubeFaceFilename(const String& filename, const Texture::CubeMapInfo& info, int face)
+	{
+		String result = filename;
+		size_t star = result.find('*');
+		result.replace(star, 1, info.face[face].suffix);
+		return result;
+	}
+
+	static bool findCubeConvention(const String& filename, CubeMapConvention& convention)
+	{
+		for (CubeMapConvention::Value candidate : s_cubeConventions)
+		{
+			const Texture::CubeMapInfo& info = Texture::cubeMapInfo(candidate);
+			bool found = true;
+			for (int face = 0; face < 6 && found; face++)
+			{
+				found = !System::findDataFile(cubeFaceFilename(filename, info, face), false).empty();
+			}
+			if (found)
+			{
+				convention = candidate;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/// <summary>
+	/// OpenGL cube map lookup: the CubeFace index direction selects, and coordinates in [0, 1] on that face
+	/// with t = 0 at the top row, as the face is uploaded
+	/// </summary>
+	static int cubeFaceCoordinates(const Vector3& d, float& s, float& t)
+	{
+		Vector3 a = d.abs();
+		int face;
+		float sc, tc, ma;
+		if (a.x >= a.y && a.x >= a.z)
+		{
+			face = d.x > 0 ? 0 : 1;
+			sc = d.x > 0 ? -d.z : d.z;
+			tc = -d.y;
+			ma = a.x;
+		}
+		else if (a.y >= a.z)
+		{
+			face = d.y > 0 ? 2 : 3;
+			sc = d.x;
+			tc = d.y > 0 ? d.z : -d.z;
+			ma = a.y;
+		}
+		else
+		{
+			face = d.z > 0 ? 4 : 5;
+			sc = d.z > 0 ? d.x : -d.x;
+			tc = -d.y;
+			ma = a.z;
+		}
+		s = 0.5f * (sc / ma + 1.0f);
+		t = 0.5f * (tc / ma + 1.0f);
+		return face;
+	}
+
+	// Known directions land on the expected face and texel, e.g. anything above the horizon on the upper half of a side face
+	static bool cubeFaceCoordinatesAreConsistent()
+	{
+		struct Expected { Vector3 direction; int face; float s, t; };
+		const Expected expected[] =
+		{
+			{ Vector3(1.0f, 0.0f, 0.0f), 0, 0.5f, 0.5f },
+			{ Vector3(-1.0f, 0.0f, 0.0f), 1, 0.5f, 0.5f },
+			{ Vector3(0.0f, 1.0f, 0.0f), 2, 0.5f, 0.5f },
+			{ Vector3(0.0f, -1.0f, 0.0f), 3, 0.5f, 0.5f },
+			{ Vector3(0.0f, 0.0f, 1.0f), 4, 0.5f, 0.5f },
+			{ Vector3(0.0f, 0.0f, -1.0f), 5, 0.5f, 0.5f },
+			{ Vector3(1.0f, 0.5f, 0.0f), 0, 0.5f, 0.25f },
+			{ Vector3(0.5f, 0.0f, -1.0f), 5, 0.25f, 0.5f },
+			{ Vector3(0.0f, 1.0f, -0.5f), 2, 0.5f, 0.25f }
+		};
+		for (const Expected& e : expected)
+		{
+			float s, t;
+			if (cubeFaceCoordinates(e.direction, s, t) != e.face || abs(s - e.s) > 1e-6f || abs(t - e.t) > 1e-6f)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Undo what G3D does to a face file before uploading it: flip, then rotate clockwise
+	static void cubeFaceToFile(const Texture::CubeMapInfo::Face& face, float& s, float& t)
+	{
+		for (int i = 0; i < face.rotations; i++)
+		{
+			const float rotatedS = s;
+			s = t;
+			t = 1.0f - rotatedS;
+		}
+		if (face.flipX)
+		{
+			s = 1.0f - s;
+		}
+		if (face.flipY)
+		{
+			t = 1.0f - t;
+		}
+	}
+
+	ReferenceCountedPointer<EnvironmentLight> EnvironmentLight::create(const String& filename, float intensity, int width)
+	{
+		return createShared<EnvironmentLight>(filename, intensity, width);
+	}
+
+	bool EnvironmentLight::exists(const String& filename)
+	{
+		if (filename.find('*') == String::npos)
+		{
+			return !System::findDataFile(filename, false).empty();
+		}
+		CubeMapConvention convention;
+		return findCubeConvention(filename, convention);
+	}
+
+	EnvironmentLight::EnvironmentLight(const String& filename, float intensity, int width)
+		: m_width(width), m_height(max(width / 2, 1)), m_intensity(intensity), m_totalWeight(0.0f), m_identity(hashBasis)
+	{
+		m_radiance.resize(m_width * m_height);
+		if (filename.find('*') == String::npos)
+		{
+			loadEquirect(filename);
+		}
+		else
+		{
+			loadCubeMap(filename);
+		}
+		buildDistribution();
+
+		hashBytes(m_identity, filename.c_str(), filename.size());
+		hashValue(m_identity, m_intensity);
+		hashValue(m_identity, m_width);
+		hashValue(m_identity, m_height);
+		// The texels too, so an edited map under the same name is told apart
+		hashBytes(m_identity, m_radiance.getCArray(), m_radiance.size() * sizeof(Color3));
+	}
+
+	void EnvironmentLight::loadEquirect(const String& filename)
+	{
+		const shared_ptr<Image>& image = Image::fromFile(System::findDataFile(filename));
+		for (int y = 0; y < m_height; y++)
+		{
+			for (int x = 0; x < m_width; x++)
+			{
+				int sx = int((x + 0.5f) / m_width * image->width());
+				int sy = int((y + 0.5f) / m_height * image->height());
+				m_radiance[y * m_width + x] = readTexel(image, sx, sy) * m_intensity;
+			}
+		}
+	}
+
+	void EnvironmentLight::loadCubeMap(const String& filename)
+	{
+		debugAssertM(cubeFaceCoordinatesAreConsistent(), "Cube map lookup sends a known direction to the wrong texel");
+		CubeMapConvention convention;
+		if (!findCubeConvention(filename, convention))
+		{
+			logPrintf("No cube map naming convention matches %s\n", filename.c_str());
+			return;
+		}
+		const Texture::CubeMapInfo& info = Texture::cubeMapInfo(convention);
+
+		shared_ptr<Image> faces[6];
+		for (int face = 0; face < 6; face++)
+		{
+			faces[face] = Image::fromFile(System::findDataFile(cubeFaceFilename(filename, info, face)));
+		}
+
+		for (int y = 0; y < m_height; y++)
+		{
+			for (int x = 0; x < m_width; x++)
+			{
+				float s, t;
+				const int face = cubeFaceCoordinates(equirectDirection((x + 0.5f) / m_width, (y + 0.5f) / m_height), s, t);
+				cubeFaceToFile(info.face[face], s, t);
+				const shared_ptr<Image>& image = faces[face];
+				m_radiance[y * m_width + x] = readTexel(image, int(s * image->width()), int(t * image->height())) * m_intensity;
+			}
+		}
+	}
+
+	void EnvironmentLight::buildDistribution()
+	{
+		m_weight.resize(m_width * m_height);
+		m_conditionalCdf.resize(m_height * (m_width + 1));
+		m_marginalCdf.resize(m_height + 1);
+
+		m_marginalCdf[0] = 0.0f;
+		for (int y = 0; y < m_height; y++)
+		{
+			float sinTheta = sin(pif() * (y + 0.5f) / m_height);
+			float* cdf = &m_conditionalCdf[y * (m_width + 1)];
+			cdf[0] = 0.0f;
+			for (int x = 0; x < m_width; x++)
+			{
+				float weight = m_radiance[y * m_width + x].average() * sinTheta;
+				m_weight[y * m_width + x] = weight;
+				cdf[x + 1] = cdf[x] + weight;
+			}
+
+			float rowWeight = cdf[m_width];
+			for (int x = 1; x <= m_width; x++)
+			{
+				cdf[x] = rowWeight > 0.0f ? cdf[x] / rowWeight : float(x) / m_width;
+			}
+			m_marginalCdf[y + 1] = m_marginalCdf[y] + rowWeight;
+		}
+
+		m_totalWeight = m_marginalCdf[m_height];
+		for (int y = 1; y <= m_height; y++)
+		{
+			m_marginalCdf[y] = m_totalWeight > 0.0f ? m_marginalCdf[y] / m_totalWeight : float(y) / m_height;
+		}
+	}
+
+	inline int EnvironmentLight::texelIndex(const Vector3& direction) const
+	{
+		float theta = acos(clamp(direction.y, -1.0f, 1.0f));
+		float phi = atan2(direction.z, direction.x);
+		int x = clamp(int((phi + pif()) / (2.0f * pif()) * m_width), 0, m_width - 1);
+		int y = clamp(int(theta / pif() * m_height), 0, m_height - 1);
+		return y * m_width + x;
+	}
+
+	Color3 EnvironmentLight::radiance(const Vector3& direction) const
+	{
+		return m_radiance[texelIndex(direction)];
+	}
+
+	Vector3 EnvironmentLight::sample(float u1, float u2, float& pdf) const
+	{
+		const float* marginalBegin = m_marginalCdf.getCArray();
+		int y = clamp(int(std::upper_bound(marginalBegin, marginalBegin + m_height + 1, u2) - marginalBegin) - 1, 0, m_height - 1);
+		float rowDelta = m_marginalCdf[y + 1] - m_marginalCdf[y];
+		float dv = rowDelta > 0.0f ? (u2 - m_marginalCdf[y]) / rowDelta : 0.5f;
+
+		const float* cdf = &m_conditionalCdf[y * (m_width + 1)];
+		int x = clamp(int(std::upper_bound(cdf, cdf + m_width + 1, u1) - cdf) - 1, 0, m_width - 1);
+		float columnDelta = cdf[x + 1] - cdf[x];
+		float du = columnDelta > 0.0f ? (u1 - cdf[x]) / columnDelta : 0.5f;
+
+		Vector3 direction = equirectDirection((x + du) / m_width, (y + dv) / m_height);
+		pdf = this->pdf(direction);
+		return direction;
+	}
+
+	float EnvironmentLight::pdf(const Vector3& direction) const
+	{
+		if (m_totalWeight <= 0.0f)
+		{
+			return 0.0f;
+		}
+		int index = texelIndex(direction);
+		float sinTheta = sin(pif() * ((index / m_width) + 0.5f) / m_height);
+		// Texel weights carry the same sin(theta) used here, so uniform-radiance rows map to a uniform solid angle density
+		return m_weight[index] * m_width * m_height / (m_totalWeight * 2.0f * square(pif()) * sinTheta);
+	}
+}
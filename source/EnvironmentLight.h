@@ -0,0 +1,75 @@
+#pragma once
+#include<G3D/G3D.h>
+
+namespace SoftRayTracing
+{
+	/// <summary>
+	/// HDR environment map resampled once into a row-major equirectangular table, with a marginal / conditional
+	/// CDF over luminance * sin(theta) for importance sampling directions toward bright regions.
+	/// </summary>
+	class EnvironmentLight : public ReferenceCountedObject
+	{
+	public:
+		Color3 radiance(const Vector3& direction) const;
+
+		/// <summary>
+		/// sample a direction proportionally to the environment's radiance
+		/// </summary>
+		/// <param name="pdf">solid angle density of the returned direction</param>
+		Vector3 sample(float u1, float u2, float& pdf) const;
+
+		/// solid angle density with which sample() returns direction
+		float pdf(const Vector3& direction) const;
+
+		inline int width() const { return m_width; }
+
+		inline int height() const { return m_height; }
+
+		/// Hash of the source filename, intensity, resolution and resampled radiance; equal for equal lighting
+		inline uint64 identity() const { return m_identity; }
+
+	public:
+		/// <summary>
+		/// load an environment map
+		/// </summary>
+		/// <param name="filename">an equirectangular image (.hdr, .exr, ...) or a cube map whose face name is replaced by '*',
+		/// e.g. "cubemap/noonclouds/noonclouds_*.png". Face names and orientation follow whichever of G3D's
+		/// Texture::cubeMapInfo conventions has all six files, as they would for a G3D cube map texture.</param>
+		/// <param name="width">width of the equirectangular table; the height is half of it</param>
+		static ReferenceCountedPointer<EnvironmentLight> create(const String& filename, float intensity = 1.0f, int width = 1024);
+
+		/// true when every file create() would need can be found
+		static bool exists(const String& filename);
+
+	protected:
+		EnvironmentLight(const String& filename, float intensity, int width);
+
+		void loadEquirect(const String& filename);
+
+		void loadCubeMap(const String& filename);
+
+		void buildDistribution();
+
+		inline int texelIndex(const Vector3& direction) const;
+
+		int m_width;
+
+		int m_height;
+
+		float m_intensity;
+
+		Array<Color3> m_radiance;
+
+		// Unnormalised luminance * sin(theta) per texel
+		Array<float> m_weight;
+
+		// m_height rows of (m_width + 1) entries each
+		Array<float> m_conditionalCdf;
+
+		Array<float> m_marginalCdf;
+
+		float m_totalWeight;
+
+		uint64 m_identity;
+	};
+}
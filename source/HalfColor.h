@@ -0,0 +1,61 @@
+#pragma once
+#include<G3D/G3D.h>
+#include <cstring>
+
+namespace SoftRayTracing
+{
+	/// IEEE 754 binary16 with round to nearest; values too small for a subnormal flush to zero
+	inline uint16 floatToHalf(float f)
+	{
+		uint32 x;
+		memcpy(&x, &f, sizeof(x));
+		const uint32 sign = (x >> 16) & 0x8000;
+		const uint32 biasedExponent = (x >> 23) & 0xFF;
+		uint32 mantissa = x & 0x7FFFFF;
+		if (biasedExponent == 0xFF)
+		{
+			return uint16(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+		}
+
+		const int exponent = int(biasedExponent) - 127 + 15;
+		if (exponent >= 31)
+		{
+			return uint16(sign | 0x7C00);
+		}
+		if (exponent <= 0)
+		{
+			if (exponent < -10)
+			{
+				return uint16(sign);
+			}
+			mantissa |= 0x800000;
+			const int shift = 14 - exponent;
+			uint32 half = mantissa >> shift;
+			if ((mantissa >> (shift - 1)) & 1)
+			{
+				half++;
+			}
+			return uint16(sign | half);
+		}
+
+		uint32 half = sign | (uint32(exponent) << 10) | (mantissa >> 13);
+		if (mantissa & 0x1000)
+		{
+			// A carry out of the mantissa correctly bumps the exponent
+			half++;
+		}
+		return uint16(half);
+	}
+
+	/// One RGBA16F texel
+	struct HalfColor4
+	{
+		uint16 r, g, b, a;
+
+		inline static HalfColor4 fromColor3(const Color3& color)
+		{
+			HalfColor4 result = { floatToHalf(color.r), floatToHalf(color.g), floatToHalf(color.b), 0x3C00 };
+			return result;
+		}
+	};
+}
@@ -1,14 +1,36 @@
 #pragma once
 #include<G3D/G3D.h>
+#include "Utils.h"
+#include "SceneArena.h"
 
 namespace SoftRayTracing
 {
 	struct HitInfo;
 
+	/// <summary>
+	/// closed set of materials the packed scene can dispatch without a virtual call
+	/// </summary>
+	enum class MaterialType : uint8
+	{
+		Lambertian,
+		Metal,
+		Dielectric,
+		Virtual
+	};
+
+	struct MaterialHandle
+	{
+		MaterialType type = MaterialType::Virtual;
+		uint32 index = 0;
+	};
+
 	class Material : public ReferenceCountedObject
 	{
 	public:
 		virtual bool scatter(const HitInfo& hitInfo, Ray& ray, Color3& attenuation) const = 0;
+
+		/// Materials outside the closed set keep the default and are always called through scatter
+		virtual MaterialType materialType() const { return MaterialType::Virtual; }
 	};
 
 	class Lambertian : public Material
@@ -16,9 +38,30 @@ namespace SoftRayTracing
 	public:
 		virtual bool scatter(const HitInfo& hitInfo, Ray& ray, Color3& attenuation) const override;
 
+		virtual MaterialType materialType() const override { return MaterialType::Lambertian; }
+
+		/// Samples cos / pi about the side of the surface the incoming ray is on, as next event estimation assumes
+		inline static bool scatter(const Color3& albedo, const Vector3& point, const Vector3& normal, Ray& ray, Color3& attenuation)
+		{
+			const Vector3 facingNormal = dot(ray.direction(), normal) < 0.0f ? normal : -normal;
+			Vector3 direction = facingNormal + uniformRandomUnit();
+			if (direction.isZero())
+			{
+				direction = facingNormal;
+			}
+			direction = direction.direction();
+			ray = Ray::fromOriginAndDirection(offsetRayOrigin(point, facingNormal, direction), direction);
+			attenuation *= albedo;
+			return true;
+		}
+
+		inline const Color3& albedo() const { return m_albedo; }
+
 	public:
 		static ReferenceCountedPointer<Lambertian> create(const Color3& albedo);
 
+		static ReferenceCountedPointer<Lambertian> create(SceneArena& arena, const Color3& albedo);
+
 		~Lambertian() = default;
 
 	protected:
@@ -32,9 +75,23 @@ namespace SoftRayTracing
 	public:
 		virtual bool scatter(const HitInfo& hitInfo, Ray& ray, Color3& attenuation) const override;
 
+		virtual MaterialType materialType() const override { return MaterialType::Metal; }
+
+		inline static bool scatter(const Color3& albedo, const Vector3& point, const Vector3& normal, Ray& ray, Color3& attenuation)
+		{
+			const Vector3 direction = ray.direction().reflectionDirection(normal);
+			ray = Ray::fromOriginAndDirection(offsetRayOrigin(point, normal, direction), direction);
+			attenuation *= albedo;
+			return true;
+		}
+
+		inline const Color3& albedo() const { return m_albedo; }
+
 	public:
 		static ReferenceCountedPointer<Metal> create(const Color3& albedo);
 
+		static ReferenceCountedPointer<Metal> create(SceneArena& arena, const Color3& albedo);
+
 		~Metal() = default;
 
 	protected:
@@ -48,18 +105,58 @@ namespace SoftRayTracing
 	public:
 		virtual bool scatter(const HitInfo& hitInfo, Ray& ray, Color3& attenuation) const override;
 
+		virtual MaterialType materialType() const override { return MaterialType::Dielectric; }
+
+		inline static bool scatter(float ir, const Vector3& point, const Vector3& normal, bool frontFace, Ray& ray, Color3& attenuation)
+		{
+			float refraction_ratio = frontFace ? (1.0f / ir) : ir;
+
+			Vector3 n = frontFace ? normal : -normal;
+			float cos_theta = dot(-ray.direction(), n);
+			float sin_theta = sqrt(1.0f - square(cos_theta));
+
+			bool cannot_refract = (refraction_ratio) > 1.0f;
+			Vector3 direction;
+
+			if (cannot_refract || reflectance(cos_theta, refraction_ratio) > sampleRandom(0.0f, 1.0f))
+			{
+				direction = ray.direction().reflectionDirection(n);
+			}
+			else
+			{
+				direction = refract(ray.direction(), n, refraction_ratio);
+			}
+			ray = Ray::fromOriginAndDirection(offsetRayOrigin(point, n, direction), direction);
+			return true;
+		}
+
+		inline float ir() const { return m_ir; }
+
 	public:
 		static ReferenceCountedPointer<Dielectric> create(float ir);
 
+		static ReferenceCountedPointer<Dielectric> create(SceneArena& arena, float ir);
+
 		~Dielectric() = default;
 
 	protected:
 		Dielectric(float ir);
 
-		Vector3 refract(const Vector3& v, const Vector3& n, float niOverNt) const;
+		inline static Vector3 refract(const Vector3& v, const Vector3& n, float niOverNt)
+		{
+			auto cos_theta = fmin(dot(-v, n), 1.0f);
+			Vector3 r_out_perp = niOverNt * (v + cos_theta * n);
+			Vector3 r_out_parallel = -sqrt(fabs(1.0f - r_out_perp.squaredMagnitude())) * n;
+			return r_out_perp + r_out_parallel;
+		}
 
 		// Use Schlick's approximation for reflectance.
-		float reflectance(float cosine, float ref_idx) const;
+		inline static float reflectance(float cosine, float ref_idx)
+		{
+			auto r0 = (1 - ref_idx) / (1 + ref_idx);
+			r0 = r0 * r0;
+			return r0 + (1 - r0) * pow((1 - cosine), 5);
+		}
 
 		float m_ir;
 	};
@@ -0,0 +1,279 @@
+#include "OfflineRender.h"
+#include "SoftRayTracingRenderer.h"
+#include "DefaultScene.h"
+#include "SceneArena.h"
+#include "EnvironmentLight.h"
+#include "Camera.h"
+#include "PackedScene.h"
+#include "BatchRenderer.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace SoftRayTracing
+{
+	bool OfflineRenderSettings::parse(int argc, const char* argv[], OfflineRenderSettings& settings)
+	{
+		bool offline = false;
+		for (int i = 1; i < argc; i++)
+		{
+			const char* arg = argv[i];
+			const bool hasValue = i + 1 < argc;
+			if (strcmp(arg, "--offline") == 0 && hasValue)
+			{
+				offline = true;
+				settings.output = argv[++i];
+			}
+			else if (strcmp(arg, "--width") == 0 && hasValue)
+			{
+				settings.width = max(atoi(argv[++i]), 1);
+			}
+			else if (strcmp(arg, "--height") == 0 && hasValue)
+			{
+				settings.height = max(atoi(argv[++i]), 1);
+			}
+			else if (strcmp(arg, "--rpp") == 0 && hasValue)
+			{
+				settings.raysPerPixel = max(atoi(argv[++i]), 1);
+			}
+			else if (strcmp(arg, "--bounces") == 0 && hasValue)
+			{
+				settings.maxBounces = max(atoi(argv[++i]), 1);
+			}
+			else if (strcmp(arg, "--time") == 0 && hasValue)
+			{
+				settings.timeBudget = max(atof(argv[++i]), 0.0);
+			}
+			else if (strcmp(arg, "--error") == 0 && hasValue)
+			{
+				settings.targetError = max(float(atof(argv[++i])), 0.0f);
+			}
+			else if (strcmp(arg, "--checkpoint") == 0 && hasValue)
+			{
+				settings.checkpoint = argv[++i];
+			}
+			else if (strcmp(arg, "--interval") == 0 && hasValue)
+			{
+				settings.checkpointInterval = max(atof(argv[++i]), 0.0);
+			}
+			else if (strcmp(arg, "--views") == 0 && hasValue)
+			{
+				settings.views = max(atoi(argv[++i]), 1);
+			}
+			else if (strcmp(arg, "--resume") == 0)
+			{
+				settings.resume = true;
+			}
+		}
+		return offline;
+	}
+
+	OfflineRenderResult renderToTarget(const OfflineRenderSettings& settings, int64 pixelCount, const std::function<void()>& renderPass,
+		const std::function<OfflineRenderStatus()>& status, const OfflineRenderProgress& progress)
+	{
+		OfflineRenderResult result;
+		const RealTime startTime = System::time();
+		// Taken from the accumulation rather than counted per pass, so coarse previews, which add nothing, and
+		// samples restored from a checkpoint are neither counted as throughput nor trusted for the error
+		float startCount = -1.0f;
+		while (true)
+		{
+			const RealTime passStart = System::time();
+			renderPass();
+			const RealTime passSeconds = System::time() - passStart;
+			const OfflineRenderStatus current = status();
+			result.passes++;
+			if (startCount < 0.0f)
+			{
+				// A resume is applied by the first pass, so its samples are those beyond this pass's
+				startCount = max(current.meanSamplesPerPixel - float(settings.raysPerPixel), 0.0f);
+			}
+
+			const RealTime elapsed = System::time() - startTime;
+			result.seconds = elapsed;
+			result.samplesPerSecond = double(current.meanSamplesPerPixel - startCount) * pixelCount / max(elapsed, 1e-6);
+
+			// A single pass has too few samples per pixel to trust the variance estimate
+			if (settings.targetError > 0.0f && current.minSamplesPerPixel >= 2.0f * settings.raysPerPixel && current.error <= settings.targetError)
+			{
+				result.stopReason = "error";
+				break;
+			}
+			if (settings.timeBudget > 0.0 && elapsed + passSeconds > settings.timeBudget)
+			{
+				result.stopReason = "time";
+				break;
+			}
+
+			// The error falls as 1 / sqrt(samples), so the target needs (error / target)^2 times the samples so far
+			RealTime remaining = settings.timeBudget > 0.0 ? settings.timeBudget - elapsed : inf();
+			if (settings.targetError > 0.0f && std::isfinite(current.error))
+			{
+				const double samplesNeeded = double(current.meanSamplesPerPixel) * pixelCount * max(square(double(current.error / settings.targetError)) - 1.0, 0.0);
+				remaining = min(remaining, samplesNeeded / result.samplesPerSecond);
+			}
+			if (progress)
+			{
+				progress(result.passes, current.meanSamplesPerPixel, current.error, result.samplesPerSecond, remaining);
+			}
+		}
+		return result;
+	}
+
+	OfflineRenderResult renderToTarget(SoftRayTracingRenderer& renderer, const ReferenceCountedPointer<Camera>& camera, Array<ReferenceCountedPointer<Hittable>>& objects,
+		const OfflineRenderSettings& settings, const OfflineRenderProgress& progress)
+	{
+		return renderToTarget(settings, int64(settings.width) * settings.height,
+			[&]()
+			{
+				renderer.renderPass(camera, objects, settings.width, settings.height);
+			},
+			[&]()
+			{
+				OfflineRenderStatus status;
+				float maxCount;
+				renderer.getSampleCountRange(status.minSamplesPerPixel, maxCount, status.meanSamplesPerPixel);
+				status.error = renderer.relativeError();
+				return status;
+			},
+			progress);
+	}
+
+	void applyCheckpointSettings(SoftRayTracingRenderer& renderer, const OfflineRenderSettings& settings)
+	{
+		if (settings.checkpoint.empty())
+		{
+			return;
+		}
+		if (settings.resume && !renderer.resumeFromCheckpoint(settings.checkpoint))
+		{
+			logPrintf("Could not resume from %s, starting over\n", settings.checkpoint.c_str());
+		}
+		renderer.setCheckpoint(settings.checkpoint, settings.checkpointInterval);
+	}
+
+	bool writeOfflineRender(const SoftRayTracingRenderer& renderer, const OfflineRenderSettings& settings, const OfflineRenderResult& result)
+	{
+		if (!renderer.writeImage(settings.output))
+		{
+			return false;
+		}
+
+		const String sidecarFilename = settings.output + ".json";
+		FILE* file = fopen(sidecarFilename.c_str(), "w");
+		if (!file)
+		{
+			return false;
+		}
+		float minCount, maxCount, meanCount;
+		renderer.getSampleCountRange(minCount, maxCount, meanCount);
+		fprintf(file, "{\n  \"samplesPerPixel\": {\"min\": %g, \"max\": %g, \"mean\": %g},\n", minCount, maxCount, meanCount);
+		fprintf(file, "  \"relativeError\": %g,\n  \"passes\": %d,\n  \"seconds\": %.3f,\n  \"samplesPerSecond\": %.0f,\n  \"stopReason\": \"%s\"\n}\n",
+			renderer.relativeError(), result.passes, result.seconds, result.samplesPerSecond, result.stopReason);
+		return fclose(file) == 0;
+	}
+
+	// output.png -> output_<index>.png
+	static String viewFilename(const String& output, int index)
+	{
+		const size_t dot = output.find_last_of('.');
+		const String suffix = format("_%d", index);
+		return (dot == String::npos) ? output + suffix : output.substr(0, dot) + suffix + output.substr(dot);
+	}
+
+	static int runBatchRender(const OfflineRenderSettings& settings)
+	{
+		if (!settings.checkpoint.empty())
+		{
+			logPrintf("Checkpoints are not supported for batch renders, ignoring %s\n", settings.checkpoint.c_str());
+		}
+
+		ReferenceCountedPointer<SceneArena> arena = SceneArena::create();
+		Array<ReferenceCountedPointer<Hittable>> objects;
+		buildDefaultScene(*arena, objects);
+		const Array<ReferenceCountedPointer<Camera>> cameras = createTurntableCameras(settings.views);
+		ReferenceCountedPointer<BatchRenderer> batch = BatchRenderer::create(objects, PackedScene::create(objects), loadDefaultEnvironment(),
+			settings.raysPerPixel, settings.maxBounces);
+
+		const OfflineRenderResult result = renderToTarget(settings, int64(settings.width) * settings.height * settings.views,
+			[&]()
+			{
+				batch->renderPass(cameras, settings.width, settings.height);
+			},
+			[&]()
+			{
+				// Every view has to reach the target
+				OfflineRenderStatus status;
+				status.minSamplesPerPixel = float(inf());
+				for (int v = 0; v < batch->viewCount(); v++)
+				{
+					float minCount, maxCount, meanCount;
+					batch->view(v)->getSampleCountRange(minCount, maxCount, meanCount);
+					status.minSamplesPerPixel = min(status.minSamplesPerPixel, minCount);
+					status.meanSamplesPerPixel += meanCount / batch->viewCount();
+					status.error = max(status.error, batch->view(v)->relativeError());
+				}
+				return status;
+			},
+			[&settings](int pass, float samplesPerPixel, float error, double samplesPerSecond, RealTime remaining)
+			{
+				logPrintf("Pass %d of %d views: %.1f spp, worst error %.4f, %.2f Msamples/s, about %.1f s left\n",
+					pass, settings.views, samplesPerPixel, error, samplesPerSecond / 1e6, remaining);
+			});
+
+		int exitCode = 0;
+		for (int v = 0; v < batch->viewCount(); v++)
+		{
+			OfflineRenderSettings viewSettings = settings;
+			viewSettings.output = viewFilename(settings.output, v);
+			if (!writeOfflineRender(*batch->view(v), viewSettings, result))
+			{
+				logPrintf("Could not write %s\n", viewSettings.output.c_str());
+				exitCode = 1;
+			}
+		}
+		logPrintf("Wrote %d views after %d passes in %.1f s (%.2f Msamples/s, stopped on %s)\n", settings.views, result.passes, result.seconds,
+			result.samplesPerSecond / 1e6, result.stopReason);
+		return exitCode;
+	}
+
+	int runOfflineRender(const OfflineRenderSettings& settings)
+	{
+		if (settings.timeBudget <= 0.0 && settings.targetError <= 0.0f)
+		{
+			logPrintf("Offline render needs --time or --error to know when to stop\n");
+			return 1;
+		}
+		if (settings.views > 1)
+		{
+			return runBatchRender(settings);
+		}
+
+		ReferenceCountedPointer<SceneArena> arena = SceneArena::create();
+		Array<ReferenceCountedPointer<Hittable>> objects;
+		buildDefaultScene(*arena, objects);
+		ReferenceCountedPointer<Camera> camera = createDefaultCamera();
+
+		ReferenceCountedPointer<SoftRayTracingRenderer> renderer = SoftRayTracingRenderer::create(settings.raysPerPixel, settings.maxBounces);
+		// Previews are only useful on screen
+		renderer->setCoarsePasses(0);
+		renderer->setEnvironment(loadDefaultEnvironment());
+		applyCheckpointSettings(*renderer, settings);
+
+		const OfflineRenderResult result = renderToTarget(*renderer, camera, objects, settings,
+			[](int pass, float samplesPerPixel, float error, double samplesPerSecond, RealTime remaining)
+			{
+				logPrintf("Pass %d: %.1f spp, error %.4f, %.2f Msamples/s, about %.1f s left\n",
+					pass, samplesPerPixel, error, samplesPerSecond / 1e6, remaining);
+			});
+
+		if (!writeOfflineRender(*renderer, settings, result))
+		{
+			logPrintf("Could not write %s\n", settings.output.c_str());
+			return 1;
+		}
+		logPrintf("Wrote %s after %d passes in %.1f s (relative error %.4f, stopped on %s)\n",
+			settings.output.c_str(), result.passes, result.seconds, renderer->relativeError(), result.stopReason);
+		return 0;
+	}
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include<G3D/G3D.h>
+#include <functional>
+
+namespace SoftRayTracing
+{
+	class Hittable;
+
+	class Camera;
+
+	class SoftRayTracingRenderer;
+
+	/// <summary>
+	/// headless render of the default scene: passes are added until the noise target is met or the next pass
+	/// would run over the time budget, then the image is written along with a JSON sidecar
+	/// (output + ".json") recording the samples per pixel actually reached.
+	/// </summary>
+	struct OfflineRenderSettings
+	{
+		String output;
+		int width = 1024;
+		int height = 768;
+		int raysPerPixel = 4;
+		int maxBounces = 16;
+		// Seconds; 0 for no limit
+		RealTime timeBudget = 0.0;
+		// Relative error, see SoftRayTracingRenderer::relativeError; 0 for no target
+		float targetError = 0.0f;
+		String checkpoint;
+		RealTime checkpointInterval = 30.0;
+		bool resume = false;
+		// More than one renders a turntable of this many views as one batch, written to output_0, output_1, ...
+		int views = 1;
+
+		/// <summary>
+		/// --offline out.png [--width w] [--height h] [--rpp n] [--bounces n] [--time seconds] [--error relative]
+		/// [--checkpoint file [--interval seconds]] [--resume] [--views n]
+		/// </summary>
+		/// <returns>true if the arguments ask for an offline render</returns>
+		static bool parse(int argc, const char* argv[], OfflineRenderSettings& settings);
+	};
+
+	struct OfflineRenderResult
+	{
+		int passes = 0;
+		RealTime seconds = 0.0;
+		double samplesPerSecond = 0.0;
+		// "error" or "time"
+		const char* stopReason = "time";
+	};
+
+	/// Called after every pass that does not finish the render, with the estimated seconds left
+	typedef std::function<void(int pass, float samplesPerPixel, float error, double samplesPerSecond, RealTime remaining)> OfflineRenderProgress;
+
+	/// What the stop rule needs to know about a render after each pass
+	struct OfflineRenderStatus
+	{
+		float minSamplesPerPixel = 0.0f;
+		float meanSamplesPerPixel = 0.0f;
+		// Relative error, see SoftRayTracingRenderer::relativeError
+		float error = 0.0f;
+	};
+
+	/// <summary>
+	/// call renderPass until the settings' error target or time budget is reached, judging each pass by status.
+	/// pixelCount is the number of pixels renderPass adds samples to, over all views it renders.
+	/// </summary>
+	OfflineRenderResult renderToTarget(const OfflineRenderSettings& settings, int64 pixelCount, const std::function<void()>& renderPass,
+		const std::function<OfflineRenderStatus()>& status, const OfflineRenderProgress& progress);
+
+	/// <summary>
+	/// add passes to renderer until the settings' error target or time budget is reached. The output, size and
+	/// budget come from settings; checkpoints and the scene are whatever renderer was set up with.
+	/// </summary>
+	OfflineRenderResult renderToTarget(SoftRayTracingRenderer& renderer, const ReferenceCountedPointer<Camera>& camera, Array<ReferenceCountedPointer<Hittable>>& objects,
+		const OfflineRenderSettings& settings, const OfflineRenderProgress& progress);
+
+	/// Resume from settings.checkpoint if asked to and keep writing it every settings.checkpointInterval; nothing without one
+	void applyCheckpointSettings(SoftRayTracingRenderer& renderer, const OfflineRenderSettings& settings);
+
+	/// Write the image to settings.output and the sample counts reached to settings.output + ".json"
+	bool writeOfflineRender(const SoftRayTracingRenderer& renderer, const OfflineRenderSettings& settings, const OfflineRenderResult& result);
+
+	/// <returns>the process exit code</returns>
+	int runOfflineRender(const OfflineRenderSettings& settings);
+}
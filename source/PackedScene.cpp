@@ -0,0 +1,166 @@
+#include "PackedScene.h"
+#include "Profiler.h"
+
+namespace SoftRayTracing
+{
+	ReferenceCountedPointer<PackedScene> PackedScene::create(const Array<ReferenceCountedPointer<Hittable>>& objects)
+	{
+		return createShared<PackedScene>(objects);
+	}
+
+	PackedScene::PackedScene(const Array<ReferenceCountedPointer<Hittable>>& objects)
+	{
+		for (const auto& object : objects)
+		{
+			switch (object->primitiveType())
+			{
+			case PrimitiveType::Sphere:
+			{
+				const Sphere* sphere = static_cast<const Sphere*>(object.get());
+				PackedSphere& packed = m_spheres.next();
+				packed.center = sphere->getPosition();
+				packed.radius = sphere->getRadius();
+				packed.material = packMaterial(sphere->getMaterial());
+				break;
+			}
+			case PrimitiveType::Plane:
+			{
+				PackedPlane& packed = m_planes.next();
+				packed.position = object->getPosition();
+				packed.rotation = object->getRotation().toRotationMatrix();
+				packed.halfSize = Vector2(object->getScale().x, object->getScale().z);
+				packed.material = packMaterial(object->getMaterial());
+				break;
+			}
+			default:
+				m_virtualObjects.append(object);
+				break;
+			}
+		}
+	}
+
+	MaterialHandle PackedScene::packMaterial(const ReferenceCountedPointer<Material>& material)
+	{
+		const MaterialHandle* existing = m_materialHandles.getPointer(material.get());
+		if (existing)
+		{
+			return *existing;
+		}
+
+		MaterialHandle handle;
+		handle.type = material->materialType();
+		switch (handle.type)
+		{
+		case MaterialType::Lambertian:
+			handle.index = m_lambertianAlbedo.size();
+			m_lambertianAlbedo.append(static_cast<const Lambertian*>(material.get())->albedo());
+			break;
+		case MaterialType::Metal:
+			handle.index = m_metalAlbedo.size();
+			m_metalAlbedo.append(static_cast<const Metal*>(material.get())->albedo());
+			break;
+		case MaterialType::Dielectric:
+			handle.index = m_dielectricIR.size();
+			m_dielectricIR.append(static_cast<const Dielectric*>(material.get())->ir());
+			break;
+		default:
+			handle.type = MaterialType::Virtual;
+			handle.index = m_virtualMaterials.size();
+			m_virtualMaterials.append(material);
+			break;
+		}
+		m_materialHandles.set(material.get(), handle);
+		return handle;
+	}
+
+	bool PackedScene::hit(const Ray& ray, float ray_min, float ray_max, HitInfo& hitInfo) const
+	{
+		t_traversalCounters.intersectionTests += m_spheres.size() + m_planes.size() + m_virtualObjects.size();
+
+		// Type-sorted batches: each loop calls a single inlined kernel and only records the closest index
+		float closest = ray_max;
+		int sphereID = -1;
+		int planeID = -1;
+		float t;
+		for (int i = 0; i < m_spheres.size(); i++)
+		{
+			const PackedSphere& sphere = m_spheres[i];
+			if (Sphere::intersect(sphere.center, sphere.radius, ray, ray_min, closest, t))
+			{
+				closest = t;
+				sphereID = i;
+			}
+		}
+		for (int i = 0; i < m_planes.size(); i++)
+		{
+			const PackedPlane& plane = m_planes[i];
+			if (Plane::intersect(plane.position, plane.rotation, plane.halfSize, ray, ray_min, closest, t))
+			{
+				closest = t;
+				planeID = i;
+				sphereID = -1;
+			}
+		}
+
+		hitInfo = missInfo;
+		for (const auto& object : m_virtualObjects)
+		{
+			HitInfo tempHitInfo;
+			if (object->hit(ray, ray_min, closest, tempHitInfo) && tempHitInfo.t < hitInfo.t)
+			{
+				hitInfo = tempHitInfo;
+				closest = tempHitInfo.t;
+				hitInfo.materialHandle = MaterialHandle();
+			}
+		}
+		if (hitInfo.t < inf())
+		{
+			return true;
+		}
+
+		if (planeID >= 0)
+		{
+			const PackedPlane& plane = m_planes[planeID];
+			hitInfo.t = closest;
+			hitInfo.point = ray_at(ray, closest);
+			hitInfo.normal = plane.rotation.column(1);
+			hitInfo.frontFace = dot(ray.direction(), hitInfo.normal) < 0;
+			hitInfo.materialHandle = plane.material;
+		}
+		else if (sphereID >= 0)
+		{
+			const PackedSphere& sphere = m_spheres[sphereID];
+			hitInfo.t = closest;
+			hitInfo.point = ray_at(ray, closest);
+			hitInfo.normal = (hitInfo.point - sphere.center) / sphere.radius;
+			hitInfo.frontFace = dot(ray.direction(), hitInfo.normal) < 0;
+			hitInfo.materialHandle = sphere.material;
+		}
+		else
+		{
+			return false;
+		}
+
+		if (hitInfo.materialHandle.type == MaterialType::Virtual)
+		{
+			hitInfo.material = m_virtualMaterials[hitInfo.materialHandle.index];
+		}
+		return true;
+	}
+
+	bool PackedScene::scatter(const HitInfo& hitInfo, Ray& ray, Color3& attenuation) const
+	{
+		const MaterialHandle& handle = hitInfo.materialHandle;
+		switch (handle.type)
+		{
+		case MaterialType::Lambertian:
+			return Lambertian::scatter(m_lambertianAlbedo[handle.index], hitInfo.point, hitInfo.normal, ray, attenuation);
+		case MaterialType::Metal:
+			return Metal::scatter(m_metalAlbedo[handle.index], hitInfo.point, hitInfo.normal, ray, attenuation);
+		case MaterialType::Dielectric:
+			return Dielectric::scatter(m_dielectricIR[handle.index], hitInfo.point, hitInfo.normal, hitInfo.frontFace, ray, attenuation);
+		default:
+			return hitInfo.material->scatter(hitInfo, ray, attenuation);
+		}
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include<G3D/G3D.h>
+#include "RayTraceGeometry.h"
+#include "Material.h"
+
+namespace SoftRayTracing
+{
+	/// <summary>
+	/// flattened copy of a scene for the render loop: the closed set of primitives and materials is stored
+	/// in per-type contiguous arrays and dispatched with a switch, so Sphere::intersect and the material
+	/// scatter kernels inline into traversal. Anything else falls back to the virtual Hittable / Material API.
+	/// It is a snapshot: the renderer rebuilds it when an object is replaced or its revision() changes.
+	/// </summary>
+	class PackedScene : public ReferenceCountedObject
+	{
+	public:
+		bool hit(const Ray& ray, float ray_min, float ray_max, HitInfo& hitInfo) const;
+
+		bool scatter(const HitInfo& hitInfo, Ray& ray, Color3& attenuation) const;
+
+		inline const Color3& lambertianAlbedo(uint32 index) const { return m_lambertianAlbedo[index]; }
+
+		inline int packedPrimitiveCount() const { return m_spheres.size() + m_planes.size(); }
+
+		inline int virtualPrimitiveCount() const { return m_virtualObjects.size(); }
+
+	public:
+		static ReferenceCountedPointer<PackedScene> create(const Array<ReferenceCountedPointer<Hittable>>& objects);
+
+	protected:
+		PackedScene(const Array<ReferenceCountedPointer<Hittable>>& objects);
+
+		MaterialHandle packMaterial(const ReferenceCountedPointer<Material>& material);
+
+		struct PackedSphere
+		{
+			Vector3 center;
+			float radius;
+			MaterialHandle material;
+		};
+
+		struct PackedPlane
+		{
+			Vector3 position;
+			Matrix3 rotation;
+			Vector2 halfSize;
+			MaterialHandle material;
+		};
+
+		Array<PackedSphere> m_spheres;
+
+		Array<PackedPlane> m_planes;
+
+		Array<Color3> m_lambertianAlbedo;
+
+		Array<Color3> m_metalAlbedo;
+
+		Array<float> m_dielectricIR;
+
+		Array<ReferenceCountedPointer<Hittable>> m_virtualObjects;
+
+		// Custom materials referenced by packed primitives
+		Array<ReferenceCountedPointer<Material>> m_virtualMaterials;
+
+		// Materials already packed, so shared materials map to one entry
+		Table<const Material*, MaterialHandle> m_materialHandles;
+	};
+}
@@ -0,0 +1,61 @@
+#include "Profiler.h"
+#include <cstdio>
+
+namespace SoftRayTracing
+{
+	thread_local TraversalCounters t_traversalCounters;
+
+	void TraceRecorder::start()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_events.fastClear();
+		m_start = std::chrono::steady_clock::now();
+		m_enabled = true;
+	}
+
+	int64 TraceRecorder::now() const
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_start).count();
+	}
+
+	void TraceRecorder::record(const Event& event)
+	{
+		if (!enabled())
+		{
+			return;
+		}
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_events.append(event);
+	}
+
+	bool TraceRecorder::stop(const String& filename)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_enabled = false;
+
+		FILE* file = fopen(filename.c_str(), "w");
+		if (!file)
+		{
+			return false;
+		}
+		fprintf(file, "{\"traceEvents\":[\n");
+		for (int i = 0; i < m_events.size(); i++)
+		{
+			const Event& event = m_events[i];
+			fprintf(file, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":0,\"tid\":%d,"
+				"\"args\":{\"x\":%d,\"y\":%d,\"width\":%d,\"height\":%d,\"rays\":%lld}}%s\n",
+				event.name, event.category, (long long)event.startMicroseconds, (long long)event.durationMicroseconds, event.threadID,
+				event.x, event.y, event.width, event.height, (long long)event.rays, (i + 1 < m_events.size()) ? "," : "");
+		}
+		fprintf(file, "],\"displayTimeUnit\":\"ms\"}\n");
+		m_events.clear();
+		return fclose(file) == 0;
+	}
+
+	int TraceRecorder::currentThreadID()
+	{
+		static std::atomic<int> s_nextThreadID{ 0 };
+		static thread_local int t_threadID = s_nextThreadID++;
+		return t_threadID;
+	}
+}
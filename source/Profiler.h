@@ -0,0 +1,64 @@
+#pragma once
+#include<G3D/G3D.h>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+
+namespace SoftRayTracing
+{
+	/// <summary>
+	/// per-thread traversal counters. Traversal bumps them unconditionally (one add per ray), and the renderer
+	/// only reads them into a per-pixel AOV when a debug display mode asks for it.
+	/// </summary>
+	struct TraversalCounters
+	{
+		uint32 intersectionTests = 0;
+		uint32 bounces = 0;
+	};
+
+	extern thread_local TraversalCounters t_traversalCounters;
+
+	/// <summary>
+	/// collects complete ("X") events for the Chrome trace event format, viewable in chrome://tracing or Perfetto.
+	/// Recording is off until start(); when off, record() is a single branch.
+	/// </summary>
+	class TraceRecorder
+	{
+	public:
+		struct Event
+		{
+			const char* name;
+			const char* category;
+			int64 startMicroseconds;
+			int64 durationMicroseconds;
+			int threadID;
+			// Optional tile rectangle and ray count, written as args
+			int x, y, width, height;
+			int64 rays;
+		};
+
+		void start();
+
+		inline bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+		/// Microseconds since start()
+		int64 now() const;
+
+		void record(const Event& event);
+
+		/// Stop recording and write {"traceEvents": [...]} to filename
+		bool stop(const String& filename);
+
+		/// Small stable id for the calling thread, used as the trace "tid"
+		static int currentThreadID();
+
+	protected:
+		std::atomic<bool> m_enabled{ false };
+
+		std::chrono::steady_clock::time_point m_start;
+
+		std::mutex m_mutex;
+
+		Array<Event> m_events;
+	};
+}
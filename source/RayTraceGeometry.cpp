@@ -9,17 +9,8 @@ namespace SoftRayTracing
 	}
 
 	Transformable::Transformable(Vector3 position, Quat rotation, Vector3 scale)
-		: m_position(position), m_rotation(rotation), m_scale(scale)
+		: m_position(position), m_rotation(rotation), m_scale(scale), m_revision(0)
 	{
-		RecalculateTransformMatrix();
-	}
-
-	void Transformable::RecalculateTransformMatrix()
-	{
-		Matrix4 translation = Matrix4::translation(m_position);
-		Matrix4 rotationMatrix = Matrix4(m_rotation.toRotationMatrix());
-		Matrix4 scaleMatrix = Matrix4::scale(m_scale);
-		m_transformMatrix = (translation * rotationMatrix * scaleMatrix).inverse();
 	}
 
 	Vector3 Transformable::getPosition() const
@@ -40,24 +31,27 @@ namespace SoftRayTracing
 	void Transformable::setPosition(Vector3 vposition)
 	{
 		m_position = vposition;
-		RecalculateTransformMatrix();
+		m_revision++;
 	}
 
 	void Transformable::setRotation(Quat vrotation)
 	{
 		m_rotation = vrotation;
-		RecalculateTransformMatrix();
+		m_revision++;
 	}
 
 	void Transformable::setScale(Vector3 vscale)
 	{
 		m_scale = vscale;
-		RecalculateTransformMatrix();
+		m_revision++;
 	}
 
 	Matrix4 Transformable::getTransformMatrix() const
 	{
-		return m_transformMatrix;
+		Matrix4 translation = Matrix4::translation(m_position);
+		Matrix4 rotationMatrix = Matrix4(m_rotation.toRotationMatrix());
+		Matrix4 scaleMatrix = Matrix4::scale(m_scale);
+		return (translation * rotationMatrix * scaleMatrix).inverse();
 	}
 
 	void Transformable::transform_ray(Ray& ray) const
@@ -84,27 +78,8 @@ namespace SoftRayTracing
 
 	bool Sphere::hit(Ray ray, float ray_min, float ray_max, HitInfo& hitInfo) const
 	{
-		transform_ray(ray);
-		float a = ray.direction().squaredMagnitude();
-		float b = 2.0f * dot(ray.origin(), ray.direction());
-		float c = ray.origin().squaredMagnitude() - square(m_radius);
-		float discriminant = b * b - 4 * a * c;
 		float t;
-		if (discriminant < 0)
-		{
-			hitInfo = missInfo;
-			return false;
-		}
-
-		if (c < 0)
-		{
-			t = (-b + sqrt(discriminant)) / (2.0f * a);
-		}
-		else
-		{
-			t = (-b - sqrt(discriminant)) / (2.0f * a);
-		}
-		if (t<ray_min || t > ray_max)
+		if (!intersect(m_position, m_radius, ray, ray_min, ray_max, t))
 		{
 			hitInfo = missInfo;
 			return false;
@@ -112,9 +87,8 @@ namespace SoftRayTracing
 		hitInfo.t = t;
 		hitInfo.point = ray_at(ray, t);
 		hitInfo.material = m_material;
-		hitInfo.normal = hitInfo.point / m_radius;
+		hitInfo.normal = (hitInfo.point - m_position) / m_radius;
 		hitInfo.frontFace = dot(ray.direction(), hitInfo.normal) < 0;
-		inverse_transform_hit(hitInfo);
 		return true;
 	}
 
@@ -123,6 +97,11 @@ namespace SoftRayTracing
 		return createShared<Sphere>(center, radius, material);
 	}
 
+	ReferenceCountedPointer<Sphere> Sphere::create(SceneArena& arena, Vector3 center, float radius, ReferenceCountedPointer<Material> material)
+	{
+		return arena.allocate<Sphere>(center, radius, material);
+	}
+
 	Sphere::Sphere(Vector3 center, float radius, ReferenceCountedPointer<Material> material)
 		: Hittable(center, Quat(Vector3::zero(),1.0f), Vector3::one(), material), m_radius(radius)
 	{
@@ -130,32 +109,19 @@ namespace SoftRayTracing
 
 	bool Plane::hit(Ray ray, float ray_min, float ray_max, HitInfo& hitInfo) const
 	{
-		transform_ray(ray);
-		float t = - ray.origin().y / ray.direction().y;
-		if (t < ray_min || t > ray_max)
+		float t;
+		Matrix3 rotationMatrix = m_rotation.toRotationMatrix();
+		if (!intersect(m_position, rotationMatrix, Vector2(m_scale.x, m_scale.z), ray, ray_min, ray_max, t))
 		{
 			hitInfo = missInfo;
 			return false;
 		}
-		else
-		{
-			Vector3 point = ray_at(ray, t);
-			if (abs(point.x) < m_scale.x && abs(point.z) < m_scale.z)
-			{
-				hitInfo.t = t;
-				hitInfo.point = point;
-				hitInfo.material = m_material;
-				hitInfo.frontFace = ray.direction().y < 0;
-				hitInfo.normal = Vector3(0.0f, 1.0f, 0.0f);
-				inverse_transform_hit(hitInfo);
-				return true;
-			}
-			else
-			{
-				hitInfo = missInfo;
-				return false;
-			}
-		}
+		hitInfo.t = t;
+		hitInfo.point = ray_at(ray, t);
+		hitInfo.material = m_material;
+		hitInfo.normal = rotationMatrix.column(1);
+		hitInfo.frontFace = dot(ray.direction(), hitInfo.normal) < 0;
+		return true;
 	}
 
 	ReferenceCountedPointer<Plane> Plane::create(Vector3 position, Quat rotation, Vector2 size, ReferenceCountedPointer<Material> material)
@@ -163,6 +129,11 @@ namespace SoftRayTracing
 		return createShared<Plane>(position, rotation, size, material);
 	}
 
+	ReferenceCountedPointer<Plane> Plane::create(SceneArena& arena, Vector3 position, Quat rotation, Vector2 size, ReferenceCountedPointer<Material> material)
+	{
+		return arena.allocate<Plane>(position, rotation, size, material);
+	}
+
 	Plane::Plane(Vector3 position, Quat rotation, Vector2 size, ReferenceCountedPointer<Material> material)
 		: Hittable(position, rotation, Vector3(size.x, 0.0f, size.y), material)
 	{
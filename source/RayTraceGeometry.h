@@ -13,6 +13,7 @@ namespace SoftRayTracing
 		Vector3 point;
 		bool frontFace;
 		ReferenceCountedPointer<Material> material;
+		MaterialHandle materialHandle;
 	};
 
 	const static HitInfo missInfo = { inf(), Vector3::zero(), Vector3::zero()};
@@ -34,12 +35,16 @@ namespace SoftRayTracing
 
 		void setScale(Vector3 vscale);
 
+		/// World to local matrix, built on each call; the render loop intersects in world space and never needs it
 		Matrix4 getTransformMatrix() const;
 
 		void transform_ray(Ray& ray) const;
 
 		void inverse_transform_hit(HitInfo& hitInfo) const;
 
+		/// Bumped by every setter, so copies of the object such as the packed scene can tell they are stale
+		inline uint32 revision() const { return m_revision; }
+
 	protected:
 		Transformable(Vector3 position, Quat rotation, Vector3 scale);
 
@@ -49,11 +54,17 @@ namespace SoftRayTracing
 
 		Vector3 m_scale;
 
-		Matrix4 m_transformMatrix;
-
-	private:
+		uint32 m_revision;
+	};
 
-		void RecalculateTransformMatrix();
+	/// <summary>
+	/// closed set of primitives the packed scene can intersect without a virtual call
+	/// </summary>
+	enum class PrimitiveType : uint8
+	{
+		Sphere,
+		Plane,
+		Virtual
 	};
 
 	class Hittable : public ReferenceCountedObject, public Transformable
@@ -65,6 +76,11 @@ namespace SoftRayTracing
 
 		virtual bool hit(Ray ray, float ray_min, float ray_max, HitInfo& hitInfo) const = 0;
 
+		/// Primitives outside the closed set keep the default and are always called through hit
+		virtual PrimitiveType primitiveType() const { return PrimitiveType::Virtual; }
+
+		inline const ReferenceCountedPointer<Material>& getMaterial() const { return m_material; }
+
 	protected:
 		ReferenceCountedPointer<Material> m_material;
 	};
@@ -78,9 +94,39 @@ namespace SoftRayTracing
 
 		
 		virtual bool hit(Ray ray, float ray_min, float ray_max, HitInfo& hitInfo) const;
+
+		virtual PrimitiveType primitiveType() const override { return PrimitiveType::Sphere; }
+
+		/// world space intersection, shared by hit and the packed scene
+		inline static bool intersect(const Vector3& center, float radius, const Ray& ray, float ray_min, float ray_max, float& t)
+		{
+			Vector3 origin = ray.origin() - center;
+			float a = ray.direction().squaredMagnitude();
+			float b = 2.0f * dot(origin, ray.direction());
+			float c = origin.squaredMagnitude() - square(radius);
+			float discriminant = b * b - 4 * a * c;
+			if (discriminant < 0)
+			{
+				return false;
+			}
+
+			if (c < 0)
+			{
+				t = (-b + sqrt(discriminant)) / (2.0f * a);
+			}
+			else
+			{
+				t = (-b - sqrt(discriminant)) / (2.0f * a);
+			}
+			return t >= ray_min && t <= ray_max;
+		}
+
+		inline float getRadius() const { return m_radius; }
 		
 
 		static ReferenceCountedPointer<Sphere> create(Vector3 center = Vector3::zero(), float radius = 1.0f, ReferenceCountedPointer<Material> material = s_greyLambertian);
+
+		static ReferenceCountedPointer<Sphere> create(SceneArena& arena, Vector3 center = Vector3::zero(), float radius = 1.0f, ReferenceCountedPointer<Material> material = s_greyLambertian);
 		
 
 	protected:
@@ -92,6 +138,26 @@ namespace SoftRayTracing
 	public:
 		
 		virtual bool hit(Ray ray, float ray_min, float ray_max, HitInfo& hitInfo) const;
+
+		virtual PrimitiveType primitiveType() const override { return PrimitiveType::Plane; }
+
+		/// <summary>
+		/// world space intersection, shared by hit and the packed scene
+		/// </summary>
+		/// <param name="rotation">local to world rotation of the plane, whose normal is the y axis</param>
+		/// <param name="halfSize">half extent along the local x and z axes</param>
+		inline static bool intersect(const Vector3& position, const Matrix3& rotation, const Vector2& halfSize, const Ray& ray, float ray_min, float ray_max, float& t)
+		{
+			Vector3 origin = ray.origin() - position;
+			Vector3 normal = rotation.column(1);
+			t = -dot(origin, normal) / dot(ray.direction(), normal);
+			if (!(t >= ray_min && t <= ray_max))
+			{
+				return false;
+			}
+			Vector3 point = origin + t * ray.direction();
+			return abs(dot(point, rotation.column(0))) < halfSize.x && abs(dot(point, rotation.column(2))) < halfSize.y;
+		}
 		
 
 		/// <summary>
@@ -103,6 +169,9 @@ namespace SoftRayTracing
 		/// <returns></returns>
 		static ReferenceCountedPointer<Plane> create(Vector3 position = Vector3::zero(), 
 			Quat rotation = Quat::fromAxisAngleRotation(Vector3(0.0f, 1.0f, 0.0f), 0.0f), Vector2 size = Vector2::one(), ReferenceCountedPointer<Material> material = s_greyLambertian);
+
+		static ReferenceCountedPointer<Plane> create(SceneArena& arena, Vector3 position = Vector3::zero(),
+			Quat rotation = Quat::fromAxisAngleRotation(Vector3(0.0f, 1.0f, 0.0f), 0.0f), Vector2 size = Vector2::one(), ReferenceCountedPointer<Material> material = s_greyLambertian);
 		
 
 	protected:
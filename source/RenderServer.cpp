@@ -0,0 +1,228 @@
+#include "RenderServer.h"
+#include "SoftRayTracingRenderer.h"
+#include "OfflineRender.h"
+#include "DefaultScene.h"
+#include "PackedScene.h"
+#include "SceneArena.h"
+#include "EnvironmentLight.h"
+#include "Camera.h"
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+
+namespace SoftRayTracing
+{
+	static Array<String> splitLine(const char* line)
+	{
+		Array<String> tokens;
+		String token;
+		for (const char* c = line; *c; c++)
+		{
+			if (*c == ' ' || *c == '\t' || *c == '\r' || *c == '\n')
+			{
+				if (!token.empty())
+				{
+					tokens.append(token);
+					token.clear();
+				}
+			}
+			else
+			{
+				token += *c;
+			}
+		}
+		if (!token.empty())
+		{
+			tokens.append(token);
+		}
+		return tokens;
+	}
+
+	ReferenceCountedPointer<RenderServer> RenderServer::create()
+	{
+		return createShared<RenderServer>();
+	}
+
+	RenderServer::RenderServer()
+	{
+		const RealTime startTime = System::time();
+		m_arena = SceneArena::create();
+		buildDefaultScene(*m_arena, m_objects);
+		m_packedScene = PackedScene::create(m_objects);
+		m_environment = loadDefaultEnvironment();
+		logPrintf("Render server: scene resident after %.3f s\n", System::time() - startTime);
+	}
+
+	RenderServer::~RenderServer()
+	{
+		reapJobs(true);
+	}
+
+	void RenderServer::serve()
+	{
+		reply("ready");
+		char line[4096];
+		while (fgets(line, sizeof(line), stdin))
+		{
+			reapJobs(false);
+			const Array<String> tokens = splitLine(line);
+			if (tokens.size() == 0)
+			{
+				continue;
+			}
+
+			const String& command = tokens[0];
+			if (command == "render")
+			{
+				startJob(tokens);
+			}
+			else if (command == "status")
+			{
+				reply("status %d", m_jobs.size());
+			}
+			else if (command == "wait")
+			{
+				reapJobs(true);
+				reply("idle");
+			}
+			else if (command == "quit")
+			{
+				break;
+			}
+			else
+			{
+				reply("failed - unknown command %s", command.c_str());
+			}
+		}
+		reapJobs(true);
+	}
+
+	void RenderServer::startJob(const Array<String>& tokens)
+	{
+		if (tokens.size() < 3)
+		{
+			reply("failed - usage: render <id> <output> [options]");
+			return;
+		}
+
+		shared_ptr<Job> job = std::make_shared<Job>();
+		job->id = tokens[1];
+		m_jobs.append(job);
+		reply("accepted %s", job->id.c_str());
+		job->thread = std::thread([this, job, tokens]
+		{
+			runJobSafely(tokens);
+			job->finished = true;
+		});
+	}
+
+	void RenderServer::runJob(const Array<String>& tokens)
+	{
+		const String& id = tokens[1];
+
+		// Reuse the offline command line options: render <id> <output> ... reads like --offline <output> ...
+		Array<const char*> argv;
+		argv.append("render");
+		argv.append("--offline");
+		for (int i = 2; i < tokens.size(); i++)
+		{
+			argv.append(tokens[i].c_str());
+		}
+		OfflineRenderSettings settings;
+		OfflineRenderSettings::parse(argv.size(), argv.getCArray(), settings);
+		if (settings.timeBudget <= 0.0 && settings.targetError <= 0.0f)
+		{
+			reply("failed %s needs --time or --error", id.c_str());
+			return;
+		}
+
+		ReferenceCountedPointer<Camera> camera = createDefaultCamera();
+		for (int i = 3; i < tokens.size(); i++)
+		{
+			if (tokens[i] == "--position" && i + 3 < tokens.size())
+			{
+				camera->SetPosition(Vector3(float(atof(tokens[i + 1].c_str())), float(atof(tokens[i + 2].c_str())), float(atof(tokens[i + 3].c_str()))));
+				i += 3;
+			}
+			else if (tokens[i] == "--yaw" && i + 1 < tokens.size())
+			{
+				camera->SetRotation(Quat::fromAxisAngleRotation(Vector3(0.0f, 1.0f, 0.0f), toRadians(float(atof(tokens[i + 1].c_str())))));
+				i += 1;
+			}
+		}
+
+		// Only the accumulation is per job; the scene and environment are shared
+		ReferenceCountedPointer<SoftRayTracingRenderer> renderer = SoftRayTracingRenderer::create(settings.raysPerPixel, settings.maxBounces);
+		renderer->setScene(m_objects, m_packedScene);
+		renderer->setEnvironment(m_environment);
+		renderer->setCoarsePasses(0);
+		applyCheckpointSettings(*renderer, settings);
+
+		Array<ReferenceCountedPointer<Hittable>> objects = m_objects;
+		const OfflineRenderResult result = renderToTarget(*renderer, camera, objects, settings,
+			[this, &id](int pass, float samplesPerPixel, float error, double samplesPerSecond, RealTime remaining)
+			{
+				reply("progress %s %d %.1f %.5f %.1f", id.c_str(), pass, samplesPerPixel, error, remaining);
+			});
+
+		if (!writeOfflineRender(*renderer, settings, result))
+		{
+			reply("failed %s could not write %s", id.c_str(), settings.output.c_str());
+			return;
+		}
+		float minCount, maxCount, meanCount;
+		renderer->getSampleCountRange(minCount, maxCount, meanCount);
+		reply("done %s %s %.1f %.5f %.3f", id.c_str(), settings.output.c_str(), meanCount, renderer->relativeError(), result.seconds);
+	}
+
+	void RenderServer::runJobSafely(const Array<String>& tokens)
+	{
+		String reason;
+		try
+		{
+			runJob(tokens);
+			return;
+		}
+		catch (const std::exception& e)
+		{
+			reason = e.what();
+		}
+		catch (const String& message)
+		{
+			// G3D reports some errors by throwing a plain string
+			reason = message;
+		}
+		catch (...)
+		{
+			reason = "unknown error";
+		}
+		// Replies are one line each
+		std::replace(reason.begin(), reason.end(), '\n', ' ');
+		reply("failed %s %s", tokens[1].c_str(), reason.c_str());
+	}
+
+	void RenderServer::reapJobs(bool waitForAll)
+	{
+		for (int i = m_jobs.size() - 1; i >= 0; i--)
+		{
+			if (waitForAll || m_jobs[i]->finished)
+			{
+				m_jobs[i]->thread.join();
+				m_jobs.fastRemove(i);
+			}
+		}
+	}
+
+	void RenderServer::reply(const char* format, ...)
+	{
+		std::lock_guard<std::mutex> lock(m_replyMutex);
+		va_list args;
+		va_start(args, format);
+		vfprintf(stdout, format, args);
+		va_end(args);
+		fputc('\n', stdout);
+		fflush(stdout);
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include<G3D/G3D.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+namespace SoftRayTracing
+{
+	class Hittable;
+
+	class PackedScene;
+
+	class SceneArena;
+
+	class EnvironmentLight;
+
+	/// <summary>
+	/// long-running render process. The scene, its packed form and the environment are built once and shared
+	/// read-only by every job; jobs run concurrently on their own threads and share the TileScheduler pool.
+	///
+	/// Jobs arrive one per line on stdin:
+	///   render &lt;id&gt; &lt;output&gt; [--width w] [--height h] [--rpp n] [--bounces n] [--time seconds] [--error relative]
+	///          [--checkpoint file [--interval seconds]] [--resume] [--position x y z] [--yaw degrees]
+	///   status
+	///   wait
+	///   quit
+	/// and results stream back on stdout as "accepted", "progress", "done" or "failed" lines tagged with the job id.
+	/// A job that throws, for example because its output cannot be written, fails alone and the server keeps running.
+	/// </summary>
+	class RenderServer : public ReferenceCountedObject
+	{
+	public:
+		/// Read commands until quit or end of input, then wait for the running jobs
+		void serve();
+
+	public:
+		static ReferenceCountedPointer<RenderServer> create();
+
+		~RenderServer();
+
+	protected:
+		struct Job
+		{
+			String id;
+			std::thread thread;
+			std::atomic<bool> finished{ false };
+		};
+
+		RenderServer();
+
+		void startJob(const Array<String>& tokens);
+
+		void runJob(const Array<String>& tokens);
+
+		/// runJob, replying "failed" for anything it throws
+		void runJobSafely(const Array<String>& tokens);
+
+		/// Join the threads of finished jobs
+		void reapJobs(bool waitForAll);
+
+		/// Write one line to stdout; lines from concurrent jobs never interleave
+		void reply(const char* format, ...);
+
+		// Storage of m_objects and of the packed scene's object handles; must be destroyed after both
+		ReferenceCountedPointer<SceneArena> m_arena;
+
+		Array<ReferenceCountedPointer<Hittable>> m_objects;
+
+		ReferenceCountedPointer<PackedScene> m_packedScene;
+
+		ReferenceCountedPointer<EnvironmentLight> m_environment;
+
+		Array<shared_ptr<Job>> m_jobs;
+
+		std::mutex m_replyMutex;
+	};
+}
@@ -0,0 +1,53 @@
+#include "SceneArena.h"
+
+namespace SoftRayTracing
+{
+	ReferenceCountedPointer<SceneArena> SceneArena::create(size_t blockSize)
+	{
+		return createShared<SceneArena>(blockSize);
+	}
+
+	SceneArena::SceneArena(size_t blockSize)
+		: m_blockSize(blockSize), m_cursor(nullptr), m_remaining(0), m_bytesAllocated(0), m_bytesReserved(0), m_objectCount(0), m_liveAllocations(0)
+	{
+	}
+
+	SceneArena::~SceneArena()
+	{
+		alwaysAssertM(m_liveAllocations == 0, format("SceneArena destroyed while %d objects allocated from it are still referenced", m_liveAllocations.load()));
+		for (uint8* block : m_blocks)
+		{
+			System::alignedFree(block);
+		}
+		m_blocks.clear();
+	}
+
+	void* SceneArena::allocateBytes(size_t bytes, size_t alignment)
+	{
+		debugAssert(alignment <= 16);
+		++m_liveAllocations;
+		size_t padding = (alignment - (size_t(m_cursor) & (alignment - 1))) & (alignment - 1);
+		if (!m_cursor || padding + bytes > m_remaining)
+		{
+			// Oversized requests get a block of their own so the current block keeps its free space
+			size_t blockSize = max(m_blockSize, bytes);
+			uint8* block = static_cast<uint8*>(System::alignedMalloc(blockSize, 16));
+			m_blocks.append(block);
+			m_bytesReserved += blockSize;
+			if (blockSize > m_blockSize)
+			{
+				m_bytesAllocated += bytes;
+				return block;
+			}
+			m_cursor = block;
+			m_remaining = blockSize;
+			padding = 0;
+		}
+
+		void* result = m_cursor + padding;
+		m_cursor += padding + bytes;
+		m_remaining -= padding + bytes;
+		m_bytesAllocated += padding + bytes;
+		return result;
+	}
+}
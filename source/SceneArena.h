@@ -0,0 +1,120 @@
+#pragma once
+#include<G3D/G3D.h>
+#include <atomic>
+
+namespace SoftRayTracing
+{
+	template<class T> class SceneArenaAllocator;
+
+	/// <summary>
+	/// lets the arena reach the protected constructors used by the create() factories, like createShared does
+	/// </summary>
+	template<class T>
+	class ArenaConstructible : public T
+	{
+	public:
+		template<class... Args>
+		ArenaConstructible(Args&&... args)
+			: T(std::forward<Args>(args)...)
+		{
+		}
+	};
+
+	/// <summary>
+	/// bump allocator for scene primitives and materials. Objects and their reference count control blocks
+	/// are placed back to back in large blocks, so building a scene does one heap allocation per block instead
+	/// of one per object, and all blocks are released in one step when the arena is destroyed.
+	/// Handles keep normal reference counting semantics but must not outlive the arena; the destructor asserts
+	/// that every handle has been released. Not thread safe: build a scene from one thread at a time
+	/// (handles may be released from any thread).
+	/// </summary>
+	class SceneArena : public ReferenceCountedObject
+	{
+	public:
+		template<class T, class... Args>
+		ReferenceCountedPointer<T> allocate(Args&&... args)
+		{
+			++m_objectCount;
+			return std::allocate_shared<ArenaConstructible<T>>(SceneArenaAllocator<ArenaConstructible<T>>(this), std::forward<Args>(args)...);
+		}
+
+		/// Each call must eventually be matched by release()
+		void* allocateBytes(size_t bytes, size_t alignment);
+
+		/// Called when an object's last handle is gone; the memory itself is only reclaimed with the arena
+		inline void release() { --m_liveAllocations; }
+
+		/// Allocations whose handles (strong or weak) are still alive
+		inline int liveAllocations() const { return m_liveAllocations.load(); }
+
+		/// Bytes handed out to objects, including control blocks and alignment padding
+		inline size_t bytesAllocated() const { return m_bytesAllocated; }
+
+		/// Bytes held in blocks
+		inline size_t bytesReserved() const { return m_bytesReserved; }
+
+		inline int objectCount() const { return m_objectCount; }
+
+		inline float bytesPerObject() const { return m_objectCount > 0 ? float(m_bytesAllocated) / m_objectCount : 0.0f; }
+
+	public:
+		static ReferenceCountedPointer<SceneArena> create(size_t blockSize = 1 << 20);
+
+		~SceneArena();
+
+	protected:
+		SceneArena(size_t blockSize);
+
+		Array<uint8*> m_blocks;
+
+		size_t m_blockSize;
+
+		uint8* m_cursor;
+
+		size_t m_remaining;
+
+		size_t m_bytesAllocated;
+
+		size_t m_bytesReserved;
+
+		int m_objectCount;
+
+		std::atomic<int> m_liveAllocations;
+	};
+
+	/// <summary>
+	/// std allocator adapter over a SceneArena; deallocation only counts, because the arena frees whole blocks
+	/// </summary>
+	template<class T>
+	class SceneArenaAllocator
+	{
+	public:
+		typedef T value_type;
+
+		explicit SceneArenaAllocator(SceneArena* arena) : m_arena(arena) {}
+
+		template<class U>
+		SceneArenaAllocator(const SceneArenaAllocator<U>& other) : m_arena(other.arena()) {}
+
+		T* allocate(size_t n)
+		{
+			return static_cast<T*>(m_arena->allocateBytes(n * sizeof(T), alignof(T)));
+		}
+
+		void deallocate(T*, size_t)
+		{
+			m_arena->release();
+		}
+
+		inline SceneArena* arena() const { return m_arena; }
+
+		template<class U>
+		bool operator==(const SceneArenaAllocator<U>& other) const { return m_arena == other.arena(); }
+
+		template<class U>
+		bool operator!=(const SceneArenaAllocator<U>& other) const { return m_arena != other.arena(); }
+
+	private:
+		SceneArena* m_arena;
+	};
+}
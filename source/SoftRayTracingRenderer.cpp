@@ -1,103 +1,948 @@
 #include "SoftRayTracingRenderer.h"
 #include "RayTraceGeometry.h"
 #include "Camera.h"
+#include "PackedScene.h"
+#include "Checkpoint.h"
+#include "EnvironmentLight.h"
+#include "TileScheduler.h"
 #include "Utils.h"
+#include <algorithm>
+#include <chrono>
 
 namespace SoftRayTracing
 {
 	SoftRayTracingRenderer::SoftRayTracingRenderer(int raysPerPixel, int maxBounceTime)
-		:raysPerPixel(raysPerPixel), maxBounceTime(maxBounceTime)
+		:raysPerPixel(raysPerPixel), maxBounceTime(maxBounceTime), m_usePackedScene(true), m_tracePacked(false), m_asyncAccelerationBuild(false), m_raysPerSecond(0.0), m_rayCount(0), m_width(0), m_height(0), m_displayMode(DisplayMode::Color), m_peakResidentBytes(0)
+		, m_passLevel(0), m_passResets(false), m_passReprojects(false), m_passRecordsCost(false), m_passInProgress(false), m_nextTile(0), m_coarsePasses(2), m_coarseLevel(2)
+		, m_frameTimeBudget(0.0), m_hasFocusPoint(false), m_hasRegionOfInterest(false)
+		, m_hasHistory(false), m_maxHistorySamples(32.0f), m_disocclusionTolerance(0.02f)
+		, m_sampleSeed(0), m_passIndex(0), m_checkpointInterval(0.0), m_lastCheckpointTime(0.0), m_batchPassStart(0)
 	{
 	}
 	void SoftRayTracingRenderer::render(RenderDevice* rd, ReferenceCountedPointer<SoftRayTracing::Camera> camera, Array<ReferenceCountedPointer<Hittable>>& objects)
 	{
-		m_objectsCache = objects;
+		const RealTime deadline = m_frameTimeBudget > 0.0 ? System::time() + m_frameTimeBudget : inf();
+		advance(camera, objects, rd->width(), rd->height(), deadline);
+		present(rd);
+	}
+
+	void SoftRayTracingRenderer::renderPass(ReferenceCountedPointer<SoftRayTracing::Camera> camera, Array<ReferenceCountedPointer<Hittable>>& objects, int width, int height)
+	{
+		advance(camera, objects, width, height, inf());
+	}
 
-		if (!m_frameTexture || m_frameTexture->width() != rd->width() || m_frameTexture->height() != rd->height())
+	// Identity of the objects' placement, shape and materials and of the environment lighting them, stored in
+	// checkpoints so a resume into a different scene is refused. Field by field, since padding in the G3D types
+	// is not initialised.
+	static uint64 sceneHash(const Array<ReferenceCountedPointer<Hittable>>& objects, const ReferenceCountedPointer<EnvironmentLight>& environment)
+	{
+		uint64 hash = hashBasis;
+		// 0 stands for the gradient sky
+		hashValue(hash, environment ? environment->identity() : uint64(0));
+		hashValue(hash, objects.size());
+		for (const ReferenceCountedPointer<Hittable>& object : objects)
 		{
-			m_frameTexture = Texture::createEmpty("FrameTexture", rd->width(), rd->height(), ImageFormat::RGB32F());
-			camera->SetAspectRatio(rd->width() / (float)rd->height());
+			const Vector3 position = object->getPosition();
+			const Quat rotation = object->getRotation();
+			const Vector3 scale = object->getScale();
+			hashValue(hash, object->primitiveType());
+			hashValue(hash, position.x); hashValue(hash, position.y); hashValue(hash, position.z);
+			hashValue(hash, rotation.x); hashValue(hash, rotation.y); hashValue(hash, rotation.z); hashValue(hash, rotation.w);
+			hashValue(hash, scale.x); hashValue(hash, scale.y); hashValue(hash, scale.z);
+			if (object->primitiveType() == PrimitiveType::Sphere)
+			{
+				hashValue(hash, static_cast<const Sphere*>(object.get())->getRadius());
+			}
+
+			const ReferenceCountedPointer<Material>& material = object->getMaterial();
+			const MaterialType materialType = material ? material->materialType() : MaterialType::Virtual;
+			hashValue(hash, materialType);
+			Color3 albedo = Color3::zero();
+			float ir = 0.0f;
+			switch (materialType)
+			{
+			case MaterialType::Lambertian:
+				albedo = static_cast<const Lambertian*>(material.get())->albedo();
+				break;
+			case MaterialType::Metal:
+				albedo = static_cast<const Metal*>(material.get())->albedo();
+				break;
+			case MaterialType::Dielectric:
+				ir = static_cast<const Dielectric*>(material.get())->ir();
+				break;
+			default:
+				break;
+			}
+			hashValue(hash, albedo.r); hashValue(hash, albedo.g); hashValue(hash, albedo.b);
+			hashValue(hash, ir);
 		}
+		return hash;
+	}
 
-		Array<Color3> frameBuffer;
-		Array<Ray> raysBuffer;
+	static std::atomic<size_t> s_rayScratchBytes(0);
 
-		//Fill the frame buffer
-		camera->generateRays(raysBuffer, rd->width(), raysPerPixel);
+	// A tile thread's ray buffer, which keeps s_rayScratchBytes equal to the capacity actually allocated
+	struct RayScratch
+	{
+		Array<Ray> rays;
+		size_t reportedBytes = 0;
 
-		float weightPerRay = 1.0f / raysPerPixel;
-		int pixelCnt = raysBuffer.size() / raysPerPixel;
-		for (int i = 0, baseRayID = 0; i < pixelCnt; i++, baseRayID+=raysPerPixel)
+		void reportSize()
 		{
-			Color3 result = Color3::zero();
-			bool isHit = false;
-			for (int j = 0; j < raysPerPixel; j++)
+			const size_t bytes = rays.sizeInMemory();
+			if (bytes != reportedBytes)
 			{
-				Ray ray = raysBuffer[baseRayID + j];
-				result += shadeRay(ray) * weightPerRay;
+				// Unsigned wrap-around makes a shrink subtract
+				s_rayScratchBytes += bytes - reportedBytes;
+				reportedBytes = bytes;
 			}
-			result = linearToGamma(result);
-			frameBuffer.append(result);
-			//Color4 uvColor = Color4(0.5f*(ray.direction().x + 1.0f), 0.5f*(ray.direction().y + 1.0f), 0.5f*(ray.direction().z + 1.0f), 1.0f);
-			//frameBuffer.append(uvColor);
+		}
+
+		~RayScratch()
+		{
+			s_rayScratchBytes -= reportedBytes;
+		}
+	};
+
+	int SoftRayTracingRenderer::beginBatchPass(const ReferenceCountedPointer<SoftRayTracing::Camera>& camera, Array<ReferenceCountedPointer<Hittable>>& objects, int width, int height)
+	{
+		m_batchPassStart = m_trace.enabled() ? m_trace.now() : 0;
+		m_rayCount = 0;
+		prepareScene(objects);
+		if (m_passInProgress)
+		{
+			endPass();
+		}
+		beginPass(camera, width, height);
+		return m_tiles.size();
+	}
+
+	void SoftRayTracingRenderer::renderBatchTile(int index)
+	{
+		renderTile(m_tiles[index]);
+	}
+
+	int64 SoftRayTracingRenderer::endBatchPass()
+	{
+		m_nextTile = m_tiles.size();
+		endPass();
+		if (m_trace.enabled())
+		{
+			TraceRecorder::Event event = { "batch pass", "pass", m_batchPassStart, m_trace.now() - m_batchPassStart, TraceRecorder::currentThreadID(),
+				0, 0, m_width, m_height, m_rayCount };
+			m_trace.record(event);
+		}
+		m_peakResidentBytes = max(m_peakResidentBytes, residentBytes());
+		return m_rayCount;
+	}
+
+	// Blue (cheap) through green and yellow to red (expensive)
+	static Color3 heatColor(float t)
+	{
+		t = clamp(t, 0.0f, 1.0f);
+		if (t < 0.33f)
+		{
+			return lerp(Color3(0.0f, 0.0f, 1.0f), Color3(0.0f, 1.0f, 0.0f), t / 0.33f);
+		}
+		if (t < 0.66f)
+		{
+			return lerp(Color3(0.0f, 1.0f, 0.0f), Color3(1.0f, 1.0f, 0.0f), (t - 0.33f) / 0.33f);
+		}
+		return lerp(Color3(1.0f, 1.0f, 0.0f), Color3(1.0f, 0.0f, 0.0f), (t - 0.66f) / 0.34f);
+	}
+
+	void SoftRayTracingRenderer::present(RenderDevice* rd)
+	{
+		if (m_displayBuffer.size() != m_width * m_height || m_width == 0)
+		{
+			return;
+		}
+
+		const Array<HalfColor4>* displayBuffer = &m_displayBuffer;
+		Array<HalfColor4> heatmap;
+		if (m_displayMode != DisplayMode::Color && m_costBuffer.size() == m_displayBuffer.size())
+		{
+			float maxCost = 0.0f;
+			for (float cost : m_costBuffer)
+			{
+				maxCost = max(maxCost, cost);
+			}
+			heatmap.resize(m_costBuffer.size());
+			for (int i = 0; i < m_costBuffer.size(); i++)
+			{
+				heatmap[i] = HalfColor4::fromColor3(heatColor(maxCost > 0.0f ? m_costBuffer[i] / maxCost : 0.0f));
+			}
+			displayBuffer = &heatmap;
+		}
+
+		if (!m_frameTexture || m_frameTexture->width() != m_width || m_frameTexture->height() != m_height)
+		{
+			m_frameTexture = Texture::createEmpty("FrameTexture", m_width, m_height, ImageFormat::RGBA16F());
 		}
 
 		// Post-process
-		const shared_ptr<PixelTransferBuffer>& ptb = CPUPixelTransferBuffer::fromData(rd->width(), rd->height(), ImageFormat::RGB32F(), frameBuffer.getCArray());
+		const shared_ptr<PixelTransferBuffer>& ptb = CPUPixelTransferBuffer::fromData(m_width, m_height, ImageFormat::RGBA16F(), displayBuffer->getCArray());
 		m_frameTexture->update(ptb);
 
 		rd->push2D(); {
 			Draw::rect2D(Rect2D::xywh(0, 0, rd->width(), rd->height()), rd, Color4(1.0f,1.0f,1.0f,1.0f), m_frameTexture);
 		} rd->pop2D();
+	}
+
+	bool SoftRayTracingRenderer::advance(const ReferenceCountedPointer<SoftRayTracing::Camera>& camera, Array<ReferenceCountedPointer<Hittable>>& objects, int width, int height, RealTime deadline)
+	{
+		const RealTime startTime = System::time();
+		const int64 traceStart = m_trace.enabled() ? m_trace.now() : 0;
+		m_rayCount = 0;
+
+		prepareScene(objects);
+
+		if (m_passInProgress && (width != m_width || height != m_height || camera != m_passCamera || camera->GetViewMatrix() != m_passViewMatrix))
+		{
+			// Tiles already done hold samples of the old view, which the next pass reprojects like the rest
+			endPass();
+		}
+		if (!m_passInProgress)
+		{
+			beginPass(camera, width, height);
+		}
+
+		// Accumulating and reset passes may be spread over several calls. A reprojecting pass is not: camera motion
+		// starts a new one every frame from the focus tile, and the outer tiles would never be reached.
+		const bool sliced = m_passLevel == 0 && !m_passReprojects;
+		while (m_nextTile < m_tiles.size())
+		{
+			int tileCount = sliced ? min(TileScheduler::threadCount(), m_tiles.size() - m_nextTile) : m_tiles.size() - m_nextTile;
+			const int firstTile = m_nextTile;
+			TileScheduler::run(tileCount, [this, firstTile](int i) { renderTile(m_tiles[firstTile + i]); });
+			m_nextTile += tileCount;
+			if (sliced && System::time() >= deadline)
+			{
+				break;
+			}
+		}
+
+		const bool completed = m_nextTile >= m_tiles.size();
+		if (completed)
+		{
+			endPass();
+		}
+		if (m_trace.enabled())
+		{
+			TraceRecorder::Event event = { "advance", m_passLevel > 0 ? "preview" : "pass", traceStart, m_trace.now() - traceStart, TraceRecorder::currentThreadID(),
+				0, 0, width, height, m_rayCount };
+			m_trace.record(event);
+		}
+		m_raysPerSecond = m_rayCount / max(System::time() - startTime, 1e-6);
+		m_peakResidentBytes = max(m_peakResidentBytes, residentBytes());
+		return completed;
+	}
+
+	void SoftRayTracingRenderer::prepareScene(Array<ReferenceCountedPointer<Hittable>>& objects)
+	{
+		// Objects edited in place keep their pointer but bump their revision
+		bool objectsChanged = objects.size() != m_objectsCache.size();
+		for (int i = 0; !objectsChanged && i < objects.size(); i++)
+		{
+			objectsChanged = objects[i] != m_objectsCache[i] || objects[i]->revision() != m_objectRevisions[i];
+		}
+		if (objectsChanged)
+		{
+			cacheObjects(objects);
+			if (m_asyncAccelerationBuild)
+			{
+				// Trace the objects directly until the packed scene is ready. Replacing a build still in flight waits for it.
+				m_packedScene = nullptr;
+				const Array<ReferenceCountedPointer<Hittable>> buildObjects = objects;
+				m_packedSceneBuild = std::async(std::launch::async, [buildObjects] { return PackedScene::create(buildObjects); });
+			}
+			else
+			{
+				m_packedScene = PackedScene::create(objects);
+			}
+			invalidateAccumulation();
+		}
+
+		// Swapping only between tile jobs means every ray of a job sees one structure. Both give the same hits,
+		// so the accumulation is kept.
+		if (m_packedSceneBuild.valid() && m_packedSceneBuild.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+		{
+			m_packedScene = m_packedSceneBuild.get();
+		}
+		m_tracePacked = m_usePackedScene && m_packedScene;
+	}
+
+	void SoftRayTracingRenderer::cacheObjects(const Array<ReferenceCountedPointer<Hittable>>& objects)
+	{
+		m_objectsCache = objects;
+		m_objectRevisions.resize(objects.size());
+		for (int i = 0; i < objects.size(); i++)
+		{
+			m_objectRevisions[i] = objects[i]->revision();
+		}
+	}
+
+	void SoftRayTracingRenderer::setScene(const Array<ReferenceCountedPointer<Hittable>>& objects, const ReferenceCountedPointer<PackedScene>& packedScene)
+	{
+		m_packedSceneBuild = std::future<ReferenceCountedPointer<PackedScene>>();
+		cacheObjects(objects);
+		m_packedScene = packedScene;
+		invalidateAccumulation();
+	}
+
+	void SoftRayTracingRenderer::invalidateAccumulation()
+	{
+		m_hasHistory = false;
+		m_coarseLevel = m_coarsePasses;
+		m_passInProgress = false;
+	}
+
+	void SoftRayTracingRenderer::beginPass(const ReferenceCountedPointer<SoftRayTracing::Camera>& camera, int width, int height)
+	{
+		const int frameSize = width * height;
+		if (width != m_width || height != m_height)
+		{
+			m_width = width;
+			m_height = height;
+			m_accumulation.resize(frameSize);
+			m_luminanceSquaredSum.resize(frameSize);
+			m_sampleCount.resize(frameSize);
+			m_firstHit.resize(frameSize);
+			m_displayBuffer.resize(frameSize);
+			invalidateAccumulation();
+		}
+		camera->SetAspectRatio(width / (float)height);
+
+		m_passRecordsCost = m_displayMode != DisplayMode::Color;
+		if (m_passRecordsCost && m_costBuffer.size() != frameSize)
+		{
+			m_costBuffer.resize(frameSize);
+			for (float& cost : m_costBuffer)
+			{
+				cost = 0.0f;
+			}
+		}
+
+		if (m_pendingResume)
+		{
+			// Checked here rather than in resumeFromCheckpoint, since only now are the frame size and scene known
+			if (m_pendingResume->width != uint32(width) || m_pendingResume->height != uint32(height))
+			{
+				logPrintf("Checkpoint ignored: it is %ux%u but the frame is %dx%d\n", m_pendingResume->width, m_pendingResume->height, width, height);
+				m_pendingResume = nullptr;
+			}
+			else if (m_pendingResume->sceneHash != sceneHash(m_objectsCache, m_environment))
+			{
+				logPrintf("Checkpoint ignored: it was rendered from a different scene\n");
+				m_pendingResume = nullptr;
+			}
+		}
+
+		if (m_pendingResume)
+		{
+			m_accumulation = m_pendingResume->accumulation;
+			m_luminanceSquaredSum = m_pendingResume->luminanceSquaredSum;
+			m_sampleCount = m_pendingResume->sampleCount;
+			// No first hits are saved, so history is only reused if the camera has not moved since the checkpoint
+			for (Vector4& firstHit : m_firstHit)
+			{
+				firstHit = Vector4(0.0f, 0.0f, 0.0f, -1.0f);
+			}
+			m_accumulationViewMatrix = m_pendingResume->viewMatrix;
+			m_sampleSeed = m_pendingResume->sampleSeed;
+			m_passIndex = m_pendingResume->passIndex;
+			m_hasHistory = true;
+			m_coarseLevel = 0;
+			m_pendingResume = nullptr;
+		}
+
+		m_passCamera = camera;
+		m_passViewMatrix = camera->GetViewMatrix();
+		if (!m_hasHistory && m_coarseLevel > 0)
+		{
+			m_passLevel = m_coarseLevel;
+			m_passResets = false;
+			m_passReprojects = false;
+		}
+		else
+		{
+			m_passLevel = 0;
+			m_passResets = !m_hasHistory;
+			m_passReprojects = m_hasHistory && m_passViewMatrix != m_accumulationViewMatrix;
+			if (m_passReprojects)
+			{
+				m_historyAccumulation = m_accumulation;
+				m_historyLuminanceSquaredSum = m_luminanceSquaredSum;
+				m_historySampleCount = m_sampleCount;
+				m_historyFirstHit = m_firstHit;
+				m_historyViewMatrix = m_accumulationViewMatrix;
+			}
+			m_accumulationViewMatrix = m_passViewMatrix;
+		}
+
+		// A reset pass starts every pixel from zero up front, so its tiles simply accumulate and the pass can be
+		// spread over several frames, with the preview showing until each tile lands. A reprojecting pass moves
+		// the accumulation to the new view, but only for the tiles it renders.
+		if (m_passResets)
+		{
+			clearSamples(false);
+		}
+		else if (m_passReprojects && m_hasRegionOfInterest)
+		{
+			clearSamples(true);
+		}
+
+		buildTiles();
+		m_nextTile = 0;
+		m_passInProgress = true;
+	}
+
+	void SoftRayTracingRenderer::regionOfInterestBounds(int& x0, int& y0, int& x1, int& y1) const
+	{
+		x0 = 0, y0 = 0, x1 = m_width, y1 = m_height;
+		if (m_hasRegionOfInterest)
+		{
+			x0 = clamp(iFloor(m_regionOfInterest.x0()), 0, m_width);
+			y0 = clamp(iFloor(m_regionOfInterest.y0()), 0, m_height);
+			x1 = clamp(iCeil(m_regionOfInterest.x1()), x0, m_width);
+			y1 = clamp(iCeil(m_regionOfInterest.y1()), y0, m_height);
+		}
+	}
+
+	void SoftRayTracingRenderer::clearSamples(bool outsideRegionOfInterestOnly)
+	{
+		int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+		if (outsideRegionOfInterestOnly)
+		{
+			regionOfInterestBounds(x0, y0, x1, y1);
+		}
+		for (int y = 0; y < m_height; y++)
+		{
+			for (int x = 0; x < m_width; x++)
+			{
+				if (x >= x0 && x < x1 && y >= y0 && y < y1)
+				{
+					continue;
+				}
+				const int pixel = y * m_width + x;
+				m_accumulation[pixel] = Color3::zero();
+				m_luminanceSquaredSum[pixel] = 0.0f;
+				m_sampleCount[pixel] = 0.0f;
+				// No first hit for this view, so nothing is reprojected from the pixel later either
+				m_firstHit[pixel] = Vector4(0.0f, 0.0f, 0.0f, -1.0f);
+			}
+		}
+	}
+
+	void SoftRayTracingRenderer::buildTiles()
+	{
+		int x0, y0, x1, y1;
+		regionOfInterestBounds(x0, y0, x1, y1);
+
+		const Vector2 focus = m_hasFocusPoint ? m_focusPoint : Vector2((x0 + x1) * 0.5f, (y0 + y1) * 0.5f);
+		const int focusTileX = iFloor(focus.x / s_tileSize);
+		const int focusTileY = iFloor(focus.y / s_tileSize);
+
+		m_tiles.fastClear();
+		for (int ty = y0 / s_tileSize; ty * s_tileSize < y1; ty++)
+		{
+			for (int tx = x0 / s_tileSize; tx * s_tileSize < x1; tx++)
+			{
+				RenderTile& tile = m_tiles.next();
+				tile.x0 = max(tx * s_tileSize, x0);
+				tile.y0 = max(ty * s_tileSize, y0);
+				tile.x1 = min((tx + 1) * s_tileSize, x1);
+				tile.y1 = min((ty + 1) * s_tileSize, y1);
+
+				// Square rings around the focus tile, each walked by angle, give a spiral
+				int dx = tx - focusTileX;
+				int dy = ty - focusTileY;
+				int ring = max(abs(dx), abs(dy));
+				float angle = (ring == 0) ? 0.0f : (atan2(float(dy), float(dx)) + pif()) / (2.0f * pif());
+				tile.priority = ring + 0.999f * angle;
+			}
+		}
+		std::sort(m_tiles.getCArray(), m_tiles.getCArray() + m_tiles.size(),
+			[](const RenderTile& a, const RenderTile& b) { return a.priority < b.priority; });
+	}
+
+	void SoftRayTracingRenderer::renderTile(const RenderTile& tile)
+	{
+		const int stride = 1 << m_passLevel;
+		const int samples = m_passLevel > 0 ? 1 : raysPerPixel;
+		// Previews draw from their own sequence so they never change what the accumulation passes see
+		const uint64 seed = m_passLevel > 0 ? ~m_sampleSeed - uint64(m_passLevel) : m_sampleSeed;
+
+		const int64 traceStart = m_trace.enabled() ? m_trace.now() : 0;
+		const bool recordCost = m_passRecordsCost;
+
+		static thread_local RayScratch scratch;
+		Array<Ray>& raysBuffer = scratch.rays;
+		raysBuffer.fastClear();
 
-		frameBuffer.clear();
-		raysBuffer.clear();
+		// Fill the tile's ray buffer
+		for (int y = tile.y0; y < tile.y1; y += stride)
+		{
+			for (int x = tile.x0; x < tile.x1; x += stride)
+			{
+				const int pixel = y * m_width + x;
+				seedSampleRandom(sampleSeed(seed, m_passIndex, 2 * uint64(pixel)));
+				for (int k = 0; k < samples; k++)
+				{
+					Vector2 offset = samples > 1 ? Vector2(sampleRandom(0.0f, 1.0f), sampleRandom(0.0f, 1.0f)) : Vector2(0.5f, 0.5f);
+					raysBuffer.append(m_passCamera->generateRay(x + offset.x, y + offset.y, m_width));
+				}
+			}
+		}
+
+		scratch.reportSize();
+
+		int64 rayCount = 0;
+		int rayID = 0;
+		for (int y = tile.y0; y < tile.y1; y += stride)
+		{
+			for (int x = tile.x0; x < tile.x1; x += stride)
+			{
+				const int pixel = y * m_width + x;
+				seedSampleRandom(sampleSeed(seed, m_passIndex, 2 * uint64(pixel) + 1));
+
+				Color3 result = Color3::zero();
+				float luminanceSquared = 0.0f;
+				Vector4 firstHit;
+				t_traversalCounters = TraversalCounters();
+				for (int j = 0; j < samples; j++, rayID++)
+				{
+					Vector4 sampleFirstHit;
+					int sampleRayCount = 0;
+					const Color3 sample = shadeRay(raysBuffer[rayID], sampleFirstHit, sampleRayCount);
+					result += sample;
+					luminanceSquared += square(sample.average());
+					rayCount += sampleRayCount;
+					if (j == 0)
+					{
+						firstHit = sampleFirstHit;
+					}
+				}
+
+				if (recordCost)
+				{
+					const uint32 counter = m_displayMode == DisplayMode::IntersectionTests ? t_traversalCounters.intersectionTests : t_traversalCounters.bounces;
+					const float cost = float(counter) / samples;
+					for (int by = y; by < min(y + stride, tile.y1); by++)
+					{
+						for (int bx = x; bx < min(x + stride, tile.x1); bx++)
+						{
+							m_costBuffer[by * m_width + bx] = cost;
+						}
+					}
+				}
+
+				if (m_passLevel > 0)
+				{
+					const HalfColor4 color = HalfColor4::fromColor3(linearToGamma(result / float(samples)));
+					for (int by = y; by < min(y + stride, tile.y1); by++)
+					{
+						for (int bx = x; bx < min(x + stride, tile.x1); bx++)
+						{
+							m_displayBuffer[by * m_width + bx] = color;
+						}
+					}
+					continue;
+				}
+
+				// A reset pass cleared every pixel when it began, so it accumulates too
+				if (!m_passReprojects)
+				{
+					m_accumulation[pixel] += result;
+					m_luminanceSquaredSum[pixel] += luminanceSquared;
+					m_sampleCount[pixel] += float(samples);
+				}
+				else
+				{
+					Color3 historySum;
+					float historySquaredSum;
+					float historyCount;
+					if (reprojectHistory(firstHit, historySum, historySquaredSum, historyCount))
+					{
+						m_accumulation[pixel] = historySum + result;
+						m_luminanceSquaredSum[pixel] = historySquaredSum + luminanceSquared;
+						m_sampleCount[pixel] = historyCount + float(samples);
+					}
+					else
+					{
+						m_accumulation[pixel] = result;
+						m_luminanceSquaredSum[pixel] = luminanceSquared;
+						m_sampleCount[pixel] = float(samples);
+					}
+				}
+				m_firstHit[pixel] = firstHit;
+
+				m_displayBuffer[pixel] = HalfColor4::fromColor3(linearToGamma(m_accumulation[pixel] / m_sampleCount[pixel]));
+			}
+		}
+		m_rayCount += rayCount;
+
+		if (m_trace.enabled())
+		{
+			TraceRecorder::Event event = { "tile", m_passLevel > 0 ? "preview" : "pass", traceStart, m_trace.now() - traceStart, TraceRecorder::currentThreadID(),
+				tile.x0, tile.y0, tile.x1 - tile.x0, tile.y1 - tile.y0, rayCount };
+			m_trace.record(event);
+		}
+	}
+
+	void SoftRayTracingRenderer::endPass()
+	{
+		m_passInProgress = false;
+		if (m_passLevel > 0)
+		{
+			m_coarseLevel = m_passLevel - 1;
+			return;
+		}
+
+		m_hasHistory = true;
+		m_passIndex++;
+
+		if (m_checkpointWriter && System::time() - m_lastCheckpointTime >= m_checkpointInterval)
+		{
+			// Copying is cheap next to a pass; the file write happens on the writer's thread
+			shared_ptr<CheckpointData> checkpoint = std::make_shared<CheckpointData>();
+			checkpoint->width = m_width;
+			checkpoint->height = m_height;
+			checkpoint->sampleSeed = m_sampleSeed;
+			checkpoint->passIndex = m_passIndex;
+			checkpoint->raysPerPixel = raysPerPixel;
+			checkpoint->maxBounces = maxBounceTime;
+			checkpoint->sceneHash = sceneHash(m_objectsCache, m_environment);
+			checkpoint->viewMatrix = m_accumulationViewMatrix;
+			checkpoint->accumulation = m_accumulation;
+			checkpoint->luminanceSquaredSum = m_luminanceSquaredSum;
+			checkpoint->sampleCount = m_sampleCount;
+			m_checkpointWriter->submit(checkpoint);
+			m_lastCheckpointTime = System::time();
+		}
+	}
+
+	float SoftRayTracingRenderer::relativeError() const
+	{
+		// Root mean square standard error of the pixel means, relative to the mean pixel luminance
+		double varianceOfMeanSum = 0.0;
+		double meanSum = 0.0;
+		int pixelCount = 0;
+		for (int i = 0; i < m_sampleCount.size(); i++)
+		{
+			const float n = m_sampleCount[i];
+			if (n < 2.0f)
+			{
+				continue;
+			}
+			const double mean = m_accumulation[i].average() / n;
+			const double variance = max(m_luminanceSquaredSum[i] / n - mean * mean, 0.0) * n / (n - 1.0);
+			varianceOfMeanSum += variance / n;
+			meanSum += mean;
+			pixelCount++;
+		}
+		if (pixelCount == 0 || meanSum <= 0.0)
+		{
+			return inf();
+		}
+		return float(sqrt(varianceOfMeanSum / pixelCount) / (meanSum / pixelCount));
+	}
+
+	void SoftRayTracingRenderer::getSampleCountRange(float& minCount, float& maxCount, float& meanCount) const
+	{
+		minCount = m_sampleCount.size() > 0 ? float(inf()) : 0.0f;
+		maxCount = 0.0f;
+		double sum = 0.0;
+		for (float count : m_sampleCount)
+		{
+			minCount = min(minCount, count);
+			maxCount = max(maxCount, count);
+			sum += count;
+		}
+		meanCount = m_sampleCount.size() > 0 ? float(sum / m_sampleCount.size()) : 0.0f;
+	}
+
+	bool SoftRayTracingRenderer::writeImage(const String& filename) const
+	{
+		if (!m_hasHistory || m_width == 0)
+		{
+			return false;
+		}
+
+		// The transfer buffers wrap the pixel arrays without copying, so each image is saved while its array is alive
+		const String extension = toLower(FilePath::ext(filename));
+		if (extension == "exr" || extension == "hdr" || extension == "pfm")
+		{
+			// Linear radiance for high dynamic range formats
+			Array<Color3> pixels;
+			pixels.resize(m_width * m_height);
+			for (int i = 0; i < pixels.size(); i++)
+			{
+				pixels[i] = m_accumulation[i] / max(m_sampleCount[i], 1.0f);
+			}
+			Image::fromPixelTransferBuffer(CPUPixelTransferBuffer::fromData(m_width, m_height, ImageFormat::RGB32F(), pixels.getCArray()))->save(filename);
+		}
+		else
+		{
+			Array<uint8> pixels;
+			pixels.resize(m_width * m_height * 3);
+			for (int i = 0; i < m_width * m_height; i++)
+			{
+				const Color3 color = linearToGamma(m_accumulation[i] / max(m_sampleCount[i], 1.0f));
+				for (int c = 0; c < 3; c++)
+				{
+					pixels[3 * i + c] = uint8(iRound(clamp(color[c], 0.0f, 1.0f) * 255.0f));
+				}
+			}
+			Image::fromPixelTransferBuffer(CPUPixelTransferBuffer::fromData(m_width, m_height, ImageFormat::RGB8(), pixels.getCArray()))->save(filename);
+		}
+		return true;
+	}
+
+	size_t SoftRayTracingRenderer::residentBytes() const
+	{
+		const size_t frameBytes =
+			m_accumulation.size() * sizeof(Color3) + m_luminanceSquaredSum.size() * sizeof(float) + m_sampleCount.size() * sizeof(float) + m_firstHit.size() * sizeof(Vector4) +
+			m_historyAccumulation.size() * sizeof(Color3) + m_historyLuminanceSquaredSum.size() * sizeof(float) + m_historySampleCount.size() * sizeof(float) +
+			m_historyFirstHit.size() * sizeof(Vector4) +
+			m_displayBuffer.size() * sizeof(HalfColor4) + m_costBuffer.size() * sizeof(float);
+		return frameBytes + s_rayScratchBytes.load();
+	}
+
+	void SoftRayTracingRenderer::setRegionOfInterest(const Rect2D& rect)
+	{
+		m_regionOfInterest = rect;
+		m_hasRegionOfInterest = true;
+	}
+
+	void SoftRayTracingRenderer::clearRegionOfInterest()
+	{
+		m_hasRegionOfInterest = false;
+	}
+
+	void SoftRayTracingRenderer::setCheckpoint(const String& filename, RealTime interval)
+	{
+		m_checkpointInterval = interval;
+		m_lastCheckpointTime = System::time();
+		if (filename.empty())
+		{
+			m_checkpointWriter = nullptr;
+		}
+		else if (!m_checkpointWriter || m_checkpointWriter->filename() != filename)
+		{
+			m_checkpointWriter = CheckpointWriter::create(filename);
+		}
+	}
+
+	void SoftRayTracingRenderer::setEnvironment(const ReferenceCountedPointer<EnvironmentLight>& environment)
+	{
+		if (environment != m_environment)
+		{
+			m_environment = environment;
+			invalidateAccumulation();
+		}
+	}
+
+	bool SoftRayTracingRenderer::resumeFromCheckpoint(const String& filename)
+	{
+		shared_ptr<CheckpointData> data = std::make_shared<CheckpointData>();
+		if (!CheckpointData::read(filename, *data))
+		{
+			return false;
+		}
+		if (data->raysPerPixel != raysPerPixel || data->maxBounces != maxBounceTime)
+		{
+			logPrintf("Checkpoint %s ignored: it was rendered with %d rays per pixel and %d bounces, not %d and %d\n",
+				filename.c_str(), data->raysPerPixel, data->maxBounces, raysPerPixel, maxBounceTime);
+			return false;
+		}
+		m_pendingResume = data;
+		return true;
+	}
+
+	bool SoftRayTracingRenderer::reprojectHistory(const Vector4& firstHit, Color3& historySum, float& historySquaredSum, float& historyCount) const
+	{
+		// Reflections and refractions move with the view, so history from the same surface point would ghost
+		if (firstHit.w == s_viewDependentHit)
+		{
+			return false;
+		}
+
+		Vector2 previousPixel;
+		if (!m_passCamera->projectToPixel(m_historyViewMatrix, firstHit, m_width, previousPixel))
+		{
+			return false;
+		}
+
+		int historyID = iFloor(previousPixel.y) * m_width + iFloor(previousPixel.x);
+		if (historyID < 0 || historyID >= m_historyFirstHit.size() || m_historySampleCount[historyID] <= 0.0f)
+		{
+			return false;
+		}
+
+		// Reject disocclusions: the previous view must have seen the same surface (or the same sky direction)
+		const Vector4& previousHit = m_historyFirstHit[historyID];
+		if (previousHit.w != firstHit.w)
+		{
+			return false;
+		}
+		if (firstHit.w == 0.0f)
+		{
+			if (dot(previousHit.xyz(), firstHit.xyz()) < 0.9995f)
+			{
+				return false;
+			}
+		}
+		else
+		{
+			float distanceToCamera = (firstHit.xyz() - m_passCamera->GetPosition()).length();
+			if ((previousHit.xyz() - firstHit.xyz()).length() > m_disocclusionTolerance * distanceToCamera)
+			{
+				return false;
+			}
+		}
+
+		float previousCount = m_historySampleCount[historyID];
+		historyCount = min(previousCount, m_maxHistorySamples);
+		historySum = m_historyAccumulation[historyID] * (historyCount / previousCount);
+		historySquaredSum = m_historyLuminanceSquaredSum[historyID] * (historyCount / previousCount);
+		return true;
 	}
 
 	void SoftRayTracingRenderer::hit(const Ray& ray, HitInfo& hitInfo) const
 	{
+		// Secondary rays start at offset origins, so the ray's own interval is used as is
+		if (m_tracePacked)
+		{
+			m_packedScene->hit(ray, ray.minDistance(), ray.maxDistance(), hitInfo);
+			return;
+		}
+
+		t_traversalCounters.intersectionTests += m_objectsCache.size();
 		hitInfo = missInfo;
+		float closest = ray.maxDistance();
 		for (auto object : m_objectsCache)
 		{
 			HitInfo tempHitInfo;
-			if (object->hit(ray, 0.001f, 1000.0f, tempHitInfo))
+			if (object->hit(ray, ray.minDistance(), closest, tempHitInfo))
 			{
-				if (tempHitInfo.t < hitInfo.t)
-				{
-					hitInfo = tempHitInfo;
-				}
+				hitInfo = tempHitInfo;
+				closest = tempHitInfo.t;
 			}
 		}
 	}
 
 	Color3 SoftRayTracingRenderer::skyBox(Vector3 direction)
 	{
+		if (m_environment)
+		{
+			return m_environment->radiance(direction);
+		}
 		return lerp(Color3(0.5, 0.7, 1.0), Color3(1.0, 1.0f, 1.0), 0.5f * direction.y + 0.5f);
 	}
 
-	Color3 SoftRayTracingRenderer::shadeRay(Ray ray)
+	bool SoftRayTracingRenderer::diffuseAlbedo(const HitInfo& hitInfo, Color3& albedo) const
+	{
+		if (m_tracePacked)
+		{
+			if (hitInfo.materialHandle.type != MaterialType::Lambertian)
+			{
+				return false;
+			}
+			albedo = m_packedScene->lambertianAlbedo(hitInfo.materialHandle.index);
+			return true;
+		}
+		if (hitInfo.material->materialType() != MaterialType::Lambertian)
+		{
+			return false;
+		}
+		albedo = static_cast<const Lambertian*>(hitInfo.material.get())->albedo();
+		return true;
+	}
+
+	// Multiple importance sampling weight for the strategy with density pdfA
+	static inline float powerHeuristic(float pdfA, float pdfB)
+	{
+		float a = square(pdfA);
+		float b = square(pdfB);
+		return a + b > 0.0f ? a / (a + b) : 0.0f;
+	}
+
+	Color3 SoftRayTracingRenderer::shadeRay(Ray ray, Vector4& firstHit, int& rayCount)
 	{
 		Color3 attenuation = Color3::one();
 		Color3 result = Color3(0.0f, 0.0f, 0.0f);
+		// Set after a diffuse bounce that also sampled the environment, so an escaping ray is MIS weighted
+		bool sampledEnvironment = false;
+		Vector3 lastNormal;
 		for (int i = 0; i < maxBounceTime; i++)
 		{
 			HitInfo hitInfo;
 			hit(ray, hitInfo);
+			rayCount++;
+			if (i == 0)
+			{
+				Color3 firstAlbedo;
+				if (hitInfo.t == inf())
+				{
+					firstHit = Vector4(ray.direction(), 0.0f);
+				}
+				else
+				{
+					firstHit = Vector4(hitInfo.point, diffuseAlbedo(hitInfo, firstAlbedo) ? 1.0f : s_viewDependentHit);
+				}
+			}
 			if (hitInfo.t < inf())
 			{
+				t_traversalCounters.bounces++;
 				//ray = Ray::fromOriginAndDirection(hitInfo.point, semisphereUniformRandomUnit(hitInfo.normal));
-				auto& material = hitInfo.material;
-				material->scatter(hitInfo, ray, attenuation);
+				Color3 albedo;
+				sampledEnvironment = m_environment && diffuseAlbedo(hitInfo, albedo);
+				if (sampledEnvironment)
+				{
+					// Next event estimation toward the environment, sharing the bounce with the BSDF sample. Both use the
+					// normal facing the incoming ray, so their pdfs cover the same hemisphere and the MIS weights sum to one.
+					lastNormal = dot(ray.direction(), hitInfo.normal) < 0.0f ? hitInfo.normal : -hitInfo.normal;
+					float lightPdf;
+					Vector3 lightDirection = m_environment->sample(sampleRandom(0.0f, 1.0f), sampleRandom(0.0f, 1.0f), lightPdf);
+					float cosTheta = dot(lightDirection, lastNormal);
+					if (lightPdf > 0.0f && cosTheta > 0.0f)
+					{
+						HitInfo shadowInfo;
+						hit(Ray::fromOriginAndDirection(offsetRayOrigin(hitInfo.point, hitInfo.normal, lightDirection), lightDirection), shadowInfo);
+						rayCount++;
+						if (shadowInfo.t == inf())
+						{
+							float bsdfPdf = cosTheta / pif();
+							result += attenuation * albedo * m_environment->radiance(lightDirection)
+								* (cosTheta / pif() / lightPdf * powerHeuristic(lightPdf, bsdfPdf));
+						}
+					}
+				}
+
+				if (m_tracePacked)
+				{
+					m_packedScene->scatter(hitInfo, ray, attenuation);
+				}
+				else
+				{
+					auto& material = hitInfo.material;
+					material->scatter(hitInfo, ray, attenuation);
+				}
 			}
 			else
 			{
-				result = skyBox(ray.direction());
+				Color3 sky = skyBox(ray.direction());
+				if (sampledEnvironment)
+				{
+					float bsdfPdf = max(dot(ray.direction(), lastNormal), 0.0f) / pif();
+					sky *= powerHeuristic(bsdfPdf, m_environment->pdf(ray.direction()));
+				}
+				result += attenuation * sky;
 				break;
 			}
 		}
-		result *= attenuation;
 		
 		return result;
 	}
 }
-
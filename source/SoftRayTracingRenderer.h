@@ -1,5 +1,9 @@
 #pragma once
 #include<G3D/G3D.h>
+#include <atomic>
+#include <future>
+#include "Profiler.h"
+#include "HalfColor.h"
 
 namespace SoftRayTracing
 {
@@ -9,26 +13,360 @@ namespace SoftRayTracing
 
 	class Camera;
 
+	class PackedScene;
+
+	class CheckpointWriter;
+
+	class EnvironmentLight;
+
+	struct CheckpointData;
+
 	class SoftRayTracingRenderer : public G3D::ReferenceCountedObject
 	{	
 	public:
 
+		/// What present() shows: the image, or a heatmap of per-pixel traversal cost
+		enum class DisplayMode
+		{
+			Color,
+			IntersectionTests,
+			Bounces
+		};
+
 		SoftRayTracingRenderer(int raysPerPixel, int maxBounceTime);
 
+		/// <summary>
+		/// advance progressive rendering at the device's size, within the frame time budget, and draw the result
+		/// </summary>
 		void render(G3D::RenderDevice* rd, ReferenceCountedPointer<SoftRayTracing::Camera> camera, Array<ReferenceCountedPointer<Hittable>>& objects);
 
+		/// <summary>
+		/// finish one whole pass at the given size without drawing anything, ignoring the frame time budget
+		/// </summary>
+		void renderPass(ReferenceCountedPointer<SoftRayTracing::Camera> camera, Array<ReferenceCountedPointer<Hittable>>& objects, int width, int height);
+
+		/// <summary>
+		/// start one whole pass whose tiles the caller schedules, e.g. to interleave several renderers' tiles in
+		/// one TileScheduler job. renderBatchTile may then be called concurrently, once for each index below the
+		/// returned tile count, followed by endBatchPass. A pass that render left unfinished is ended first.
+		/// </summary>
+		/// <returns>the number of tiles in the pass</returns>
+		int beginBatchPass(const ReferenceCountedPointer<SoftRayTracing::Camera>& camera, Array<ReferenceCountedPointer<Hittable>>& objects, int width, int height);
+
+		void renderBatchTile(int index);
+
+		/// <returns>the rays traced by the pass</returns>
+		int64 endBatchPass();
+
+		/// Upload the display buffer and draw it over the whole device
+		void present(G3D::RenderDevice* rd);
+
 		void hit(const Ray& ray, HitInfo& hitInfo) const;
 
+		/// <summary>
+		/// render objects through a packed scene built elsewhere, so several renderers can share one resident scene.
+		/// packedScene must have been built from exactly these objects.
+		/// </summary>
+		void setScene(const Array<ReferenceCountedPointer<Hittable>>& objects, const ReferenceCountedPointer<PackedScene>& packedScene);
+
+		/// <summary>
+		/// trace through the packed, devirtualised scene (default) or through the virtual Hittable / Material API
+		/// </summary>
+		inline void setUsePackedScene(bool usePackedScene) { m_usePackedScene = usePackedScene; }
+
+		inline bool usePackedScene() const { return m_usePackedScene; }
+
+		/// <summary>
+		/// build the packed scene on a background thread when the objects change, tracing the objects directly
+		/// until it is ready, instead of blocking the render call that saw the change
+		/// </summary>
+		inline void setAsyncAccelerationBuild(bool async) { m_asyncAccelerationBuild = async; }
+
+		/// <summary>
+		/// false while the last render traced the objects directly because the packed scene was still being built
+		/// </summary>
+		inline bool accelerationReady() const { return !m_usePackedScene || m_tracePacked; }
+
+		/// <summary>
+		/// snapshot the accumulation to filename every interval seconds, written atomically on a background thread.
+		/// An empty filename disables checkpoints.
+		/// </summary>
+		void setCheckpoint(const String& filename, RealTime interval);
+
+		/// <summary>
+		/// continue from a checkpoint written by setCheckpoint; the accumulation is restored on the next render
+		/// at the same frame size and continues the same sample sequence as an uninterrupted run.
+		/// A checkpoint from another scene or frame size is logged and dropped at that render.
+		/// </summary>
+		/// <returns>false if the file is missing, invalid or was rendered with other rays per pixel or bounces</returns>
+		bool resumeFromCheckpoint(const String& filename);
+
+		/// <summary>
+		/// light the scene with an environment map, sampled explicitly from diffuse surfaces.
+		/// Without one, rays that escape see a constant gradient.
+		/// </summary>
+		void setEnvironment(const ReferenceCountedPointer<EnvironmentLight>& environment);
+
+		/// <summary>
+		/// stop starting new tiles after this many seconds per render call, so the first tiles show up right away.
+		/// Passes that reproject the accumulation always run to the end. Zero disables the budget.
+		/// </summary>
+		inline void setFrameTimeBudget(RealTime budget) { m_frameTimeBudget = budget; }
+
+		/// Tiles are rendered in a spiral around this pixel (e.g. the mouse cursor) instead of the frame centre
+		inline void setFocusPoint(const Vector2& pixel) { m_focusPoint = pixel; m_hasFocusPoint = true; }
+
+		inline void clearFocusPoint() { m_hasFocusPoint = false; }
+
+		/// <summary>
+		/// only render pixels inside rect, at full quality. Pixels outside keep their last displayed value,
+		/// but a pass that resets or reprojects drops their samples, so they start over once the region is cleared.
+		/// </summary>
+		void setRegionOfInterest(const Rect2D& rect);
+
+		void clearRegionOfInterest();
+
+		/// <summary>
+		/// number of low resolution preview passes after the accumulation is reset. Pass n renders one sample per
+		/// 2^n x 2^n block and is only displayed, never accumulated.
+		/// </summary>
+		inline void setCoarsePasses(int coarsePasses) { m_coarsePasses = coarsePasses; m_coarseLevel = min(m_coarseLevel, coarsePasses); }
+
+		/// <summary>
+		/// show a debug AOV instead of the image. The AOV is only gathered while a heatmap is shown and never
+		/// changes the accumulated result. Changing mode zeroes the gathered costs, which the next pass
+		/// gathers again, so a heatmap never shows costs of another view or another counter.
+		/// </summary>
+		inline void setDisplayMode(DisplayMode mode)
+		{
+			if (mode != m_displayMode)
+			{
+				// Keep the size: a pass in progress may still record costs into it
+				for (float& cost : m_costBuffer)
+				{
+					cost = 0.0f;
+				}
+			}
+			m_displayMode = mode;
+		}
+
+		inline DisplayMode displayMode() const { return m_displayMode; }
+
+		/// Record per-thread tile timings until stopTrace
+		inline void startTrace() { m_trace.start(); }
+
+		inline bool tracing() const { return m_trace.enabled(); }
+
+		/// Write the recorded tiles and passes as a Chrome trace event JSON file
+		inline bool stopTrace(const String& filename) { return m_trace.stop(filename); }
+
+		/// <summary>
+		/// estimated relative error of the accumulated image: the RMS standard error of the pixel means over
+		/// the mean pixel luminance. Infinite until pixels have at least two samples.
+		/// </summary>
+		float relativeError() const;
+
+		void getSampleCountRange(float& minCount, float& maxCount, float& meanCount) const;
+
+		/// <summary>
+		/// save the accumulated image. .exr, .hdr and .pfm get linear radiance, anything else gamma encoded 8-bit.
+		/// </summary>
+		/// <returns>false if nothing has been accumulated yet</returns>
+		bool writeImage(const String& filename) const;
+
+		inline int raysPerPixelPerPass() const { return raysPerPixel; }
+
+		/// <summary>
+		/// bytes currently held by the frame buffers, plus the measured capacity of the per-thread ray buffers.
+		/// The ray buffers belong to the tile threads and are shared by every renderer in the process.
+		/// </summary>
+		size_t residentBytes() const;
+
+		/// Largest residentBytes seen so far
+		inline size_t peakResidentBytes() const { return m_peakResidentBytes; }
+
+		/// Bytes uploaded to the display texture by each present
+		inline size_t uploadBytesPerFrame() const { return size_t(m_width) * m_height * sizeof(HalfColor4); }
+
+		/// Rays traced per second during the last render call
+		inline double raysPerSecond() const { return m_raysPerSecond; }
+
 	protected:
+		struct RenderTile
+		{
+			int x0, y0, x1, y1;
+			// Spiral position around the focus point; tiles are rendered in increasing order
+			float priority;
+		};
+
+		static const int s_tileSize = 32;
+
+		// m_firstHit w of a surface whose shading depends on the view direction; such pixels never reuse history
+		static constexpr float s_viewDependentHit = 2.0f;
+
+		/// <returns>true once the current pass has finished</returns>
+		bool advance(const ReferenceCountedPointer<SoftRayTracing::Camera>& camera, Array<ReferenceCountedPointer<Hittable>>& objects, int width, int height, RealTime deadline);
+
+		void prepareScene(Array<ReferenceCountedPointer<Hittable>>& objects);
+
+		void cacheObjects(const Array<ReferenceCountedPointer<Hittable>>& objects);
+
+		void beginPass(const ReferenceCountedPointer<SoftRayTracing::Camera>& camera, int width, int height);
+
+		/// Pixel bounds of the region of interest, or the whole frame without one
+		void regionOfInterestBounds(int& x0, int& y0, int& x1, int& y1) const;
+
+		/// Zero the samples of every pixel, or only of those outside the region of interest, which this pass will not render
+		void clearSamples(bool outsideRegionOfInterestOnly);
+
+		void buildTiles();
+
+		void renderTile(const RenderTile& tile);
+
+		void endPass();
+
+		/// Drop the accumulation and any pass in progress, and show coarse previews again
+		void invalidateAccumulation();
 
 		Color3 skyBox(Vector3 direction);
 
-		Color3 shadeRay(Ray ray);
+		/// <param name="firstHit">world space first hit point (w = 1 on a diffuse surface, s_viewDependentHit on any other),
+		/// or the escape direction (w = 0) on a miss</param>
+		Color3 shadeRay(Ray ray, Vector4& firstHit, int& rayCount);
+
+		/// <returns>true with the albedo if the hit surface is Lambertian</returns>
+		bool diffuseAlbedo(const HitInfo& hitInfo, Color3& albedo) const;
+
+		/// <summary>
+		/// look up the accumulated history for a pixel whose first hit is firstHit in the current view
+		/// </summary>
+		/// <returns>false on disocclusion or when the point was off screen in the previous view</returns>
+		bool reprojectHistory(const Vector4& firstHit, Color3& historySum, float& historySquaredSum, float& historyCount) const;
 
 		ReferenceCountedPointer<G3D::Texture> m_frameTexture;
 
 		Array<ReferenceCountedPointer<Hittable>> m_objectsCache;
 
+		// revision() of each cached object when m_packedScene and the accumulation were last rebuilt
+		Array<uint32> m_objectRevisions;
+
+		ReferenceCountedPointer<PackedScene> m_packedScene;
+
+		ReferenceCountedPointer<EnvironmentLight> m_environment;
+
+		bool m_usePackedScene;
+
+		// Whether the current job traces m_packedScene; only changes between tile jobs
+		bool m_tracePacked;
+
+		bool m_asyncAccelerationBuild;
+
+		std::future<ReferenceCountedPointer<PackedScene>> m_packedSceneBuild;
+
+		double m_raysPerSecond;
+
+		std::atomic<int64> m_rayCount;
+
+		int m_width;
+
+		int m_height;
+
+		// Gamma encoded display copy, uploaded as RGBA16F; the full precision result is m_accumulation
+		Array<HalfColor4> m_displayBuffer;
+
+		size_t m_peakResidentBytes;
+
+		DisplayMode m_displayMode;
+
+		// Average per sample of the current DisplayMode's counter, filled only while a heatmap is shown
+		Array<float> m_costBuffer;
+
+		TraceRecorder m_trace;
+
+		// Trace clock when beginBatchPass was called
+		int64 m_batchPassStart;
+
+		// Current pass
+		ReferenceCountedPointer<SoftRayTracing::Camera> m_passCamera;
+
+		Matrix4 m_passViewMatrix;
+
+		// 0 for an accumulation pass, n for a preview with one sample per 2^n block
+		int m_passLevel;
+
+		bool m_passResets;
+
+		bool m_passReprojects;
+
+		// Fixed when the pass begins, which sizes m_costBuffer for it, so a display mode change mid-pass is safe
+		bool m_passRecordsCost;
+
+		bool m_passInProgress;
+
+		Array<RenderTile> m_tiles;
+
+		int m_nextTile;
+
+		int m_coarsePasses;
+
+		// Level of the next preview pass, 0 once previews are done
+		int m_coarseLevel;
+
+		RealTime m_frameTimeBudget;
+
+		Vector2 m_focusPoint;
+
+		bool m_hasFocusPoint;
+
+		Rect2D m_regionOfInterest;
+
+		bool m_hasRegionOfInterest;
+
+		// Progressive accumulation of linear radiance, one entry per pixel
+		Array<Color3> m_accumulation;
+
+		// Sum of squared per-sample luminance, for the variance estimate
+		Array<float> m_luminanceSquaredSum;
+
+		Array<float> m_sampleCount;
+
+		// First hit point and surface kind per pixel, see shadeRay
+		Array<Vector4> m_firstHit;
+
+		Matrix4 m_accumulationViewMatrix;
+
+		// Accumulation of the previous view, the source of a reprojecting pass
+		Array<Color3> m_historyAccumulation;
+
+		Array<float> m_historyLuminanceSquaredSum;
+
+		Array<float> m_historySampleCount;
+
+		Array<Vector4> m_historyFirstHit;
+
+		Matrix4 m_historyViewMatrix;
+
+		bool m_hasHistory;
+
+		// Reprojected history never counts for more than this many samples, so stale shading fades out
+		float m_maxHistorySamples;
+
+		// Maximum distance between the old and new first hit, relative to the distance from the camera
+		float m_disocclusionTolerance;
+
+		// Sample sequence position: every pixel of pass n is seeded from (m_sampleSeed, n, pixel)
+		uint64 m_sampleSeed;
+
+		uint64 m_passIndex;
+
+		ReferenceCountedPointer<CheckpointWriter> m_checkpointWriter;
+
+		RealTime m_checkpointInterval;
+
+		RealTime m_lastCheckpointTime;
+
+		shared_ptr<CheckpointData> m_pendingResume;
+
 	public:
 		
 		static ReferenceCountedPointer<SoftRayTracingRenderer> create(int raysPerPixel,int maxBounceTime)
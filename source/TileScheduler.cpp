@@ -0,0 +1,181 @@
+#include "TileScheduler.h"
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <exception>
+
+namespace SoftRayTracing
+{
+	namespace
+	{
+		struct Job
+		{
+			int count;
+			const TileScheduler::Callback* callback;
+			std::atomic<int> next;
+			std::atomic<int> remaining;
+			bool finished;
+			// First exception thrown by the callback; once set, the remaining items are skipped
+			std::exception_ptr error;
+			std::atomic<bool> failed;
+		};
+
+		class WorkerPool
+		{
+		public:
+			WorkerPool()
+				: m_quit(false)
+			{
+				int workerCount = max(int(std::thread::hardware_concurrency()) - 1, 1);
+				for (int i = 0; i < workerCount; i++)
+				{
+					m_workers.push_back(std::thread(&WorkerPool::workerMain, this));
+				}
+			}
+
+			~WorkerPool()
+			{
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_quit = true;
+				}
+				m_wakeWorkers.notify_all();
+				for (std::thread& worker : m_workers)
+				{
+					worker.join();
+				}
+			}
+
+			void run(int count, const TileScheduler::Callback& callback)
+			{
+				if (count <= 0)
+				{
+					return;
+				}
+
+				shared_ptr<Job> job = std::make_shared<Job>();
+				job->count = count;
+				job->callback = &callback;
+				job->next = 0;
+				job->remaining = count;
+				job->finished = false;
+				job->failed = false;
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_jobs.push_back(job);
+				}
+				m_wakeWorkers.notify_all();
+
+				// The caller works on its own job instead of idling
+				while (runItem(*job)) {}
+
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_jobDone.wait(lock, [&job] { return job->finished; });
+				for (auto it = m_jobs.begin(); it != m_jobs.end(); ++it)
+				{
+					if (*it == job)
+					{
+						m_jobs.erase(it);
+						break;
+					}
+				}
+				lock.unlock();
+
+				// Only rethrow once no worker can touch the job or the caller's callback any more
+				if (job->error)
+				{
+					std::rethrow_exception(job->error);
+				}
+			}
+
+			inline int workerCount() const { return int(m_workers.size()); }
+
+		private:
+			bool runItem(Job& job)
+			{
+				int item = job.next.fetch_add(1);
+				if (item >= job.count)
+				{
+					return false;
+				}
+				if (!job.failed)
+				{
+					try
+					{
+						(*job.callback)(item);
+					}
+					catch (...)
+					{
+						std::lock_guard<std::mutex> lock(m_mutex);
+						if (!job.error)
+						{
+							job.error = std::current_exception();
+						}
+						job.failed = true;
+					}
+				}
+				if (job.remaining.fetch_sub(1) == 1)
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					job.finished = true;
+					m_jobDone.notify_all();
+				}
+				return true;
+			}
+
+			void workerMain()
+			{
+				while (true)
+				{
+					shared_ptr<Job> job;
+					{
+						std::unique_lock<std::mutex> lock(m_mutex);
+						m_wakeWorkers.wait(lock, [this] { return m_quit || !m_jobs.empty(); });
+						if (m_quit)
+						{
+							return;
+						}
+						job = m_jobs.front();
+						if (job->next >= job->count)
+						{
+							// Fully handed out; the owner is waiting for the last items to finish
+							m_jobs.pop_front();
+							continue;
+						}
+					}
+					while (runItem(*job)) {}
+				}
+			}
+
+			std::vector<std::thread> m_workers;
+
+			std::deque<shared_ptr<Job>> m_jobs;
+
+			std::mutex m_mutex;
+
+			std::condition_variable m_wakeWorkers;
+
+			std::condition_variable m_jobDone;
+
+			bool m_quit;
+		};
+
+		WorkerPool& workerPool()
+		{
+			static WorkerPool pool;
+			return pool;
+		}
+	}
+
+	void TileScheduler::run(int count, const Callback& callback)
+	{
+		workerPool().run(count, callback);
+	}
+
+	int TileScheduler::threadCount()
+	{
+		return workerPool().workerCount() + 1;
+	}
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include<G3D/G3D.h>
+#include <functional>
+
+namespace SoftRayTracing
+{
+	/// <summary>
+	/// process-wide pool of render workers. Items of a job are handed out in index order, so callers control
+	/// priority by how they order their work. Several threads may run jobs at once; they share the same workers.
+	/// </summary>
+	class TileScheduler
+	{
+	public:
+		typedef std::function<void(int itemIndex)> Callback;
+
+		/// Run callback for every item in [0, count) on the pool and the calling thread, blocking until all are done.
+		/// If an item throws, the remaining items are skipped and the first exception is rethrown on the calling thread
+		static void run(int count, const Callback& callback);
+
+		/// Number of threads that can execute items of one job, including the caller
+		static int threadCount();
+	};
+}
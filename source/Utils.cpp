@@ -1,13 +1,78 @@
 #pragma once
 #include "Utils.h"
+#include <cstring>
 
 namespace SoftRayTracing
 {
+	static thread_local uint64 s_sampleState = 0x9E3779B97F4A7C15ull;
+
+	// splitmix64 finaliser
+	static inline uint64 mix64(uint64 z)
+	{
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+
+	void seedSampleRandom(uint64 seed)
+	{
+		s_sampleState = seed;
+	}
+
+	uint64 sampleSeed(uint64 baseSeed, uint64 passIndex, uint64 stream)
+	{
+		return mix64(mix64(mix64(baseSeed) ^ passIndex) ^ stream);
+	}
+
+	float sampleRandom(float low, float high)
+	{
+		s_sampleState += 0x9E3779B97F4A7C15ull;
+		uint32 bits = uint32(mix64(s_sampleState) >> 40);
+		return low + (high - low) * (bits * (1.0f / 16777216.0f));
+	}
+
 	Vector3 uniformRandomUnit()
 	{
-		float theta = uniformRandom(0, 2 * pi());
-		float phi = uniformRandom(0, pi() / 2);
-		return Vector3(cos(phi) * cos(theta), cos(phi) * sin(theta), sin(phi));
+		// Uniform in z over [-1, 1] is uniform in area (Archimedes), so normal + uniformRandomUnit() is
+		// cosine distributed about the normal, which the Lambertian pdf cos / pi in shadeRay relies on
+		float z = sampleRandom(-1.0f, 1.0f);
+		float phi = sampleRandom(0.0f, 2.0f * pif());
+		float r = sqrt(max(0.0f, 1.0f - z * z));
+		return Vector3(r * cos(phi), r * sin(phi), z);
+	}
+
+	void hashBytes(uint64& hash, const void* bytes, size_t size)
+	{
+		const uint8* byte = static_cast<const uint8*>(bytes);
+		for (size_t i = 0; i < size; i++)
+		{
+			hash = (hash ^ byte[i]) * 0x100000001b3ull;
+		}
+	}
+
+	Point3 offsetRayOrigin(const Point3& point, const Vector3& normal, const Vector3& direction)
+	{
+		// Wächter and Binder, "A Fast and Robust Method for Avoiding Self-Intersection": step each coordinate a
+		// fixed number of ulps along the normal, which grows with the coordinate like its rounding error does.
+		// Ulps vanish near zero, so coordinates close to the world origin get a small absolute offset instead.
+		const float originThreshold = 1.0f / 32.0f;
+		const float floatScale = 1.0f / 65536.0f;
+		const float intScale = 256.0f;
+
+		const Vector3 n = dot(direction, normal) < 0.0f ? -normal : normal;
+		Point3 result;
+		for (int i = 0; i < 3; i++)
+		{
+			const float p = point[i];
+			const int32 offset = int32(intScale * n[i]);
+			int32 bits;
+			memcpy(&bits, &p, sizeof(bits));
+			bits += (p < 0.0f) ? -offset : offset;
+			float stepped;
+			memcpy(&stepped, &bits, sizeof(stepped));
+			result[i] = fabs(p) < originThreshold ? p + floatScale * n[i] : stepped;
+		}
+		return result;
 	}
 
 	Vector3 semisphereUniformRandomUnit(Vector3 normal)
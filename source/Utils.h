@@ -3,6 +3,39 @@
 
 namespace SoftRayTracing
 {
+	/// <summary>
+	/// seed the calling thread's sample sequence. The renderer reseeds it per pixel and pass, so a render
+	/// is reproducible (and resumable) regardless of which thread shades which pixel.
+	/// </summary>
+	void seedSampleRandom(uint64 seed);
+
+	/// hash a base seed with the pass index and a pixel or stream id into a sequence seed
+	uint64 sampleSeed(uint64 baseSeed, uint64 passIndex, uint64 stream);
+
+	/// uniform random number from the calling thread's sample sequence
+	float sampleRandom(float low, float high);
+
+	/// FNV-1a offset basis, the value to start hashBytes from
+	constexpr uint64 hashBasis = 0xcbf29ce484222325ull;
+
+	/// fold bytes into an FNV-1a hash, e.g. to identify a scene across runs
+	void hashBytes(uint64& hash, const void* bytes, size_t size);
+
+	/// Only for types without padding, whose bytes are all initialised
+	template<typename T>
+	inline void hashValue(uint64& hash, const T& value)
+	{
+		hashBytes(hash, &value, sizeof(T));
+	}
+
+	/// <summary>
+	/// origin for a ray leaving a surface at point, pushed along the normal just far enough to clear the rounding
+	/// error of the hit point, on the side direction leaves through. The offset scales with the coordinates'
+	/// magnitude, so it holds for scenes of any size without a fixed epsilon.
+	/// </summary>
+	Point3 offsetRayOrigin(const Point3& point, const Vector3& normal, const Vector3& direction);
+
+	/// uniformly distributed over the whole unit sphere
 	Vector3 uniformRandomUnit();
 
 	Vector3 semisphereUniformRandomUnit(Vector3 normal);